@@ -16,6 +16,8 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <iterator>
 #include <cstring>
 #include <cassert>
 #include <algorithm>
@@ -60,10 +62,19 @@ using hotstuff::DataStream;
 using hotstuff::ReplicaID;
 using hotstuff::MsgReqCmd;
 using hotstuff::MsgRespCmd;
+using hotstuff::MsgRespProof;
+using hotstuff::MsgReqCmdBatch;
+using hotstuff::MsgRespCmdBatch;
+using hotstuff::MsgReqRead;
+using hotstuff::MsgRespRead;
 using hotstuff::get_hash;
 using hotstuff::promise_t;
 
+#ifdef HOTSTUFF_ED25519
+using HotStuff = hotstuff::HotStuffEd25519;
+#else
 using HotStuff = hotstuff::HotStuffSecp256k1;
+#endif
 
 class HotStuffApp: public HotStuff {
     double stat_period;
@@ -75,24 +86,40 @@ class HotStuffApp: public HotStuff {
     ClientNetwork<opcode_t> cn;
     /** Timer object to schedule a periodic printing of system statistics */
     TimerEvent ev_stat_timer;
-    /** Timer object to monitor the progress for simple impeachment */
-    TimerEvent impeach_timer;
+    /** Timer object to monitor the progress for simple impeachment (reset
+     * upon every block, so it is on the timer wheel) */
+    hotstuff::WheelTimer impeach_timer;
     /** The listen address for client RPC */
     NetAddr clisten_addr;
 
     std::unordered_map<const uint256_t, promise_t> unconfirmed;
 
     using conn_t = ClientNetwork<opcode_t>::conn_t;
-    using resp_queue_t = salticidae::MPSCQueueEventDriven<std::pair<Finality, NetAddr>>;
+    struct ClientResp {
+        Finality fin;
+        NetAddr addr;
+        /** whether the client batches its commands (and the responses) */
+        bool batched;
+    };
+    using resp_batch_t = std::vector<ClientResp>;
+    using resp_queue_t = salticidae::MPSCQueueEventDriven<resp_batch_t>;
 
     /* for the dedicated thread sending responses to the clients */
     std::thread req_thread;
     std::thread resp_thread;
     resp_queue_t resp_queue;
+    /** the responses for the block being committed */
+    resp_batch_t resp_batch;
+    /** submit the commands within the sessions of their clients */
+    bool client_sessions;
     salticidae::BoxObj<salticidae::ThreadCall> resp_tcall;
     salticidae::BoxObj<salticidae::ThreadCall> req_tcall;
 
     void client_request_cmd_handler(MsgReqCmd &&, const conn_t &);
+    void client_request_cmd_batch_handler(MsgReqCmdBatch &&, const conn_t &);
+    void process_cmd(const command_t &cmd, const NetAddr &addr,
+                    uint8_t resp_mode, bool batched);
+    void client_request_read_handler(MsgReqRead &&, const conn_t &);
 
     static command_t parse_cmd(DataStream &s) {
         auto cmd = new CommandDummy();
@@ -105,13 +132,21 @@ class HotStuffApp: public HotStuff {
         impeach_timer.add(impeach_timeout);
     }
 
-    void state_machine_execute(const Finality &fin) override {
+    void state_machine_execute_blk(const hotstuff::BlockFinality &bfin) override {
         reset_imp_timer();
 #ifndef HOTSTUFF_ENABLE_BENCHMARK
-        HOTSTUFF_LOG_INFO("replicated %s", std::string(fin).c_str());
+        for (size_t i = 0; i < bfin.size(); i++)
+            HOTSTUFF_LOG_INFO("replicated %s", std::string(bfin.get(i)).c_str());
 #endif
     }
 
+    void state_machine_decided_blk(const hotstuff::BlockFinality &) override {
+        /* hand over the responses of the whole block at once */
+        if (resp_batch.empty()) return;
+        resp_queue.enqueue(std::move(resp_batch));
+        resp_batch.clear();
+    }
+
 #ifdef HOTSTUFF_MSG_STAT
     std::unordered_set<conn_t> client_conns;
     void print_stat() const;
@@ -133,6 +168,7 @@ class HotStuffApp: public HotStuff {
 
     void start(const std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> &reps);
     void stop();
+    void set_client_sessions(bool enabled) { client_sessions = enabled; }
 };
 
 std::pair<std::string, std::string> split_ip_port_cport(const std::string &s) {
@@ -166,11 +202,36 @@ int main(int argc, char **argv) {
     auto opt_prop_delay = Config::OptValDouble::create(1);
     auto opt_imp_timeout = Config::OptValDouble::create(11);
     auto opt_nworker = Config::OptValInt::create(1);
+    auto opt_nsigner = Config::OptValInt::create(1);
     auto opt_repnworker = Config::OptValInt::create(1);
     auto opt_repburst = Config::OptValInt::create(100);
     auto opt_clinworker = Config::OptValInt::create(8);
     auto opt_cliburst = Config::OptValInt::create(1000);
     auto opt_notls = Config::OptValFlag::create(false);
+    auto opt_prune_staleness = Config::OptValInt::create(100);
+    auto opt_prune_budget = Config::OptValDouble::create(0.001);
+    auto opt_ckpt_period = Config::OptValInt::create(0);
+    auto opt_blk_log = Config::OptValStr::create();
+    auto opt_snapshot = Config::OptValStr::create();
+    auto opt_snapshot_period = Config::OptValDouble::create(10);
+    auto opt_fault_schedule = Config::OptValStr::create();
+    auto opt_batch_delay = Config::OptValDouble::create(0);
+    auto opt_compress_threshold = Config::OptValInt::create(0);
+    auto opt_compress_budget = Config::OptValDouble::create(0.1);
+    auto opt_compress_dict = Config::OptValStr::create();
+    auto opt_batch_bytes = Config::OptValInt::create(65536);
+    auto opt_fault_seed = Config::OptValInt::create(0);
+    auto opt_read_timeout = Config::OptValDouble::create(5);
+    auto opt_learners = Config::OptValStrVec::create();
+    auto opt_learner_addr = Config::OptValStr::create();
+    auto opt_learn_from = Config::OptValStrVec::create();
+    auto opt_header_first = Config::OptValFlag::create(false);
+    auto opt_client_sessions = Config::OptValFlag::create(false);
+    auto opt_read_index = Config::OptValFlag::create(false);
+    auto opt_commit_feed = Config::OptValStr::create();
+    auto opt_feed_records = Config::OptValInt::create(65536);
+    auto opt_replay_window = Config::OptValInt::create(0);
+    auto opt_swarm_sync = Config::OptValInt::create(0);
 
     config.add_opt("block-size", opt_blk_size, Config::SET_VAL);
     config.add_opt("parent-limit", opt_parent_limit, Config::SET_VAL);
@@ -187,11 +248,36 @@ int main(int argc, char **argv) {
     config.add_opt("prop-delay", opt_prop_delay, Config::SET_VAL, 't', "set the delay that follows the timeout for the Round-Robin Pacemaker");
     config.add_opt("imp-timeout", opt_imp_timeout, Config::SET_VAL, 'u', "set impeachment timeout (for sticky)");
     config.add_opt("nworker", opt_nworker, Config::SET_VAL, 'n', "the number of threads for verification");
+    config.add_opt("nsigner", opt_nsigner, Config::SET_VAL, 'k', "the number of threads for signing votes (0 to sign on the event loop)");
     config.add_opt("repnworker", opt_repnworker, Config::SET_VAL, 'm', "the number of threads for replica network");
     config.add_opt("repburst", opt_repburst, Config::SET_VAL, 'b', "");
     config.add_opt("clinworker", opt_clinworker, Config::SET_VAL, 'M', "the number of threads for client network");
     config.add_opt("cliburst", opt_cliburst, Config::SET_VAL, 'B', "");
     config.add_opt("notls", opt_notls, Config::SWITCH_ON, 's', "disable TLS");
+    config.add_opt("prune-staleness", opt_prune_staleness, Config::SET_VAL, 'P', "the number of committed blocks kept in memory (0 to disable pruning)");
+    config.add_opt("prune-budget", opt_prune_budget, Config::SET_VAL, 'T', "the time budget (in seconds) for each pruning tick");
+    config.add_opt("ckpt-period", opt_ckpt_period, Config::SET_VAL, 'K', "take a certified checkpoint every K committed blocks (0 to disable)");
+    config.add_opt("blk-log", opt_blk_log, Config::SET_VAL, 'L', "log the committed blocks to the given directory");
+    config.add_opt("snapshot", opt_snapshot, Config::SET_VAL, 'S', "keep a warm-start snapshot of the consensus state in the given file");
+    config.add_opt("snapshot-period", opt_snapshot_period, Config::SET_VAL, 'W', "interval (in seconds) of writing the snapshot (0 to only write upon shutdown)");
+    config.add_opt("batch-delay", opt_batch_delay, Config::SET_VAL, 'g', "coalesce the votes and block fetch messages to the same replica within the given delay (in seconds, 0 to disable)");
+    config.add_opt("batch-bytes", opt_batch_bytes, Config::SET_VAL, 'G', "maximum size (in bytes) of a coalesced batch");
+    config.add_opt("compress-threshold", opt_compress_threshold, Config::SET_VAL, 'z', "compress the block messages not smaller than the given size (in bytes, 0 to disable)");
+    config.add_opt("compress-budget", opt_compress_budget, Config::SET_VAL, 'Z', "CPU time (in seconds per second) allowed for compression");
+    config.add_opt("compress-dict", opt_compress_dict, Config::SET_VAL, 'y', "dictionary file for compression, which should be given to all replicas (including those not compressing), as the others are sent uncompressed messages");
+    config.add_opt("fault-schedule", opt_fault_schedule, Config::SET_VAL, 'F', "inject the faults in the given schedule file into the outgoing messages");
+    config.add_opt("fault-seed", opt_fault_seed, Config::SET_VAL, 'D', "seed of the random choices of the fault injection");
+    config.add_opt("read-index", opt_read_index, Config::SWITCH_ON, 'R', "serve the read-only requests from the executed state (on all replicas)");
+    config.add_opt("read-timeout", opt_read_timeout, Config::SET_VAL, 'r', "fail a read-only request not confirmed within the given time (in seconds)");
+    config.add_opt("learner", opt_learners, Config::APPEND, 'e', "add a non-voting learner (addr, tls cert hash) fed with the committed blocks");
+    config.add_opt("learner-addr", opt_learner_addr, Config::SET_VAL, 'o', "run as a non-voting learner binding to the given address (ip:port;cport)");
+    config.add_opt("learn-from", opt_learn_from, Config::APPEND, 'f', "the index of a replica feeding this learner");
+    config.add_opt("header-first", opt_header_first, Config::SWITCH_ON, 'H', "propose the block headers and send the bodies separately");
+    config.add_opt("client-sessions", opt_client_sessions, Config::SWITCH_ON, 'x', "deduplicate the retried commands by the client sessions (a client should not reuse its sequence numbers across restarts)");
+    config.add_opt("commit-feed", opt_commit_feed, Config::SET_VAL, 'q', "stream the committed blocks to the local consumers connecting to the given address");
+    config.add_opt("feed-records", opt_feed_records, Config::SET_VAL, 'Q', "the number of recent committed blocks kept for the feed consumers to resume from");
+    config.add_opt("replay-window", opt_replay_window, Config::SET_VAL, 'w', "reject the replays of the commands committed within the given number of heights (0 to disable)");
+    config.add_opt("swarm-sync", opt_swarm_sync, Config::SET_VAL, 'j', "catch up in segments of the given number of heights, requested in parallel from different replicas (0 to disable)");
     config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
 
     EventContext ec;
@@ -212,9 +298,12 @@ int main(int argc, char **argv) {
         replicas.push_back(std::make_tuple(res[0], res[1], res[2]));
     }
 
-    if (!(0 <= idx && (size_t)idx < replicas.size()))
+    bool learner = !opt_learner_addr->get().empty();
+    if (learner)
+        idx = replicas.size(); /* outside the replica configuration */
+    else if (!(0 <= idx && (size_t)idx < replicas.size()))
         throw HotStuffError("replica idx out of range");
-    std::string binding_addr = std::get<0>(replicas[idx]);
+    std::string binding_addr = learner ? opt_learner_addr->get() : std::get<0>(replicas[idx]);
     if (client_port == -1)
     {
         auto p = split_ip_port_cport(binding_addr);
@@ -230,7 +319,8 @@ int main(int argc, char **argv) {
 
     auto parent_limit = opt_parent_limit->get();
     hotstuff::pacemaker_bt pmaker;
-    if (opt_pace_maker->get() == "dummy")
+    /* a learner never proposes */
+    if (learner || opt_pace_maker->get() == "dummy")
         pmaker = new hotstuff::PaceMakerDummyFixed(opt_fixed_proposer->get(), parent_limit);
     else
         pmaker = new hotstuff::PaceMakerRR(ec, parent_limit, opt_base_timeout->get(), opt_prop_delay->get());
@@ -268,6 +358,64 @@ int main(int argc, char **argv) {
                         opt_nworker->get(),
                         repnet_config,
                         clinet_config);
+    papp->set_prune(opt_prune_staleness->get(), opt_prune_budget->get());
+    papp->set_ckpt_period(opt_ckpt_period->get());
+    if (!opt_blk_log->get().empty())
+        papp->set_blk_log(opt_blk_log->get());
+    if (!opt_snapshot->get().empty())
+        papp->set_snapshot(opt_snapshot->get(), opt_snapshot_period->get());
+    papp->set_nsigner(opt_nsigner->get());
+    papp->set_read_index(opt_read_index->get());
+    papp->set_read_timeout(opt_read_timeout->get());
+    papp->set_header_first(opt_header_first->get());
+    papp->set_client_sessions(opt_client_sessions->get());
+    if (!opt_commit_feed->get().empty())
+        papp->set_commit_feed(NetAddr(opt_commit_feed->get()), opt_feed_records->get());
+    if (opt_replay_window->get() > 0)
+        papp->set_replay_filter(opt_replay_window->get());
+    if (opt_swarm_sync->get() > 0)
+        papp->set_swarm_sync(opt_swarm_sync->get());
+    if (learner)
+    {
+        std::vector<ReplicaID> sources;
+        for (const auto &s: opt_learn_from->get())
+            sources.push_back(std::stoi(s));
+        if (sources.empty())
+            throw HotStuffError("learner without any source (learn-from)");
+        papp->set_learner(sources);
+    }
+    else
+    {
+        for (const auto &s: opt_learners->get())
+        {
+            auto res = trim_all(split(s, ","));
+            if (res.size() != 2)
+                throw HotStuffError("invalid learner info");
+            papp->add_learner(NetAddr(split_ip_port_cport(res[0]).first),
+                            uint256_t(hotstuff::from_hex(res[1])));
+        }
+    }
+    papp->set_batching(opt_batch_delay->get(), opt_batch_bytes->get());
+    if (opt_compress_threshold->get() > 0 || !opt_compress_dict->get().empty())
+    {
+        bytearray_t dict;
+        if (!opt_compress_dict->get().empty())
+        {
+            std::ifstream in(opt_compress_dict->get(), std::ios::binary);
+            if (!in)
+                throw HotStuffError("cannot open the dictionary %s",
+                                    opt_compress_dict->get().c_str());
+            dict = bytearray_t(std::istreambuf_iterator<char>(in),
+                                std::istreambuf_iterator<char>());
+        }
+        /* with a zero threshold the dictionary is only used to decompress
+         * the messages from the peers */
+        papp->set_compression(3, opt_compress_threshold->get(),
+                            opt_compress_threshold->get() > 0 ?
+                                opt_compress_budget->get() : 0, dict);
+    }
+    if (!opt_fault_schedule->get().empty())
+        papp->set_fault_schedule(opt_fault_schedule->get(), opt_fault_seed->get());
     std::vector<std::tuple<NetAddr, bytearray_t, bytearray_t>> reps;
     for (auto &r: replicas)
     {
@@ -306,18 +454,37 @@ HotStuffApp::HotStuffApp(uint32_t blk_size,
     impeach_timeout(impeach_timeout),
     ec(ec),
     cn(req_ec, clinet_config),
-    clisten_addr(clisten_addr) {
+    clisten_addr(clisten_addr),
+    client_sessions(false) {
     /* prepare the thread used for sending back confirmations */
     resp_tcall = new salticidae::ThreadCall(resp_ec);
     req_tcall = new salticidae::ThreadCall(req_ec);
     resp_queue.reg_handler(resp_ec, [this](resp_queue_t &q) {
-        std::pair<Finality, NetAddr> p;
-        while (q.try_dequeue(p))
+        resp_batch_t batch;
+        while (q.try_dequeue(batch))
         {
-            try {
-                cn.send_msg(MsgRespCmd(std::move(p.first)), p.second);
-            } catch (std::exception &err) {
-                HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
+            /* the responses to a batching client go in one message */
+            std::unordered_map<NetAddr, std::vector<Finality>> fins;
+            for (auto &r: batch)
+            {
+                if (r.batched)
+                {
+                    fins[r.addr].push_back(std::move(r.fin));
+                    continue;
+                }
+                try {
+                    cn.send_msg(MsgRespCmd(std::move(r.fin)), r.addr);
+                } catch (std::exception &err) {
+                    HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
+                }
+            }
+            for (auto &p: fins)
+            {
+                try {
+                    cn.send_msg(MsgRespCmdBatch(p.second), p.first);
+                } catch (std::exception &err) {
+                    HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
+                }
             }
         }
         return false;
@@ -325,17 +492,77 @@ HotStuffApp::HotStuffApp(uint32_t blk_size,
 
     /* register the handlers for msg from clients */
     cn.reg_handler(salticidae::generic_bind(&HotStuffApp::client_request_cmd_handler, this, _1, _2));
+    cn.reg_handler(salticidae::generic_bind(&HotStuffApp::client_request_cmd_batch_handler, this, _1, _2));
+    cn.reg_handler(salticidae::generic_bind(&HotStuffApp::client_request_read_handler, this, _1, _2));
     cn.start();
     cn.listen(clisten_addr);
 }
 
 void HotStuffApp::client_request_cmd_handler(MsgReqCmd &&msg, const conn_t &conn) {
-    const NetAddr addr = conn->get_addr();
     auto cmd = parse_cmd(msg.serialized);
+    process_cmd(cmd, conn->get_addr(), msg.parse_resp_mode(), false);
+}
+
+void HotStuffApp::client_request_cmd_batch_handler(MsgReqCmdBatch &&msg, const conn_t &conn) {
+    const NetAddr addr = conn->get_addr();
+    for (uint32_t i = 0; i < msg.ncmds; i++)
+        process_cmd(parse_cmd(msg.serialized), addr, msg.resp_mode, true);
+}
+
+void HotStuffApp::process_cmd(const command_t &cmd, const NetAddr &addr,
+                            uint8_t resp_mode, bool batched) {
     const auto &cmd_hash = cmd->get_hash();
     HOTSTUFF_LOG_DEBUG("processing %s", std::string(*cmd).c_str());
-    exec_command(cmd_hash, [this, addr](Finality fin) {
-        resp_queue.enqueue(std::make_pair(fin, addr));
+    auto callback = [this, addr, resp_mode, batched](Finality fin) {
+        if (resp_mode == MsgReqCmd::RESP_NONE) return;
+        if (resp_mode == MsgReqCmd::RESP_PROOF)
+        {
+            hotstuff::CommitProof proof;
+            /* otherwise fall back to a plain acknowledgement */
+            if (prove_commit(fin, proof))
+            {
+                auto resp = std::make_shared<MsgRespProof>(fin, proof);
+                resp_tcall->async_call([this, resp, addr](salticidae::ThreadCall::Handle &) {
+                    try {
+                        cn.send_msg(std::move(*resp), addr);
+                    } catch (std::exception &err) {
+                        HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
+                    }
+                });
+                return;
+            }
+        }
+        /* the batch is only flushed after a committed block is decided */
+        if (fin.decision == 1 && is_deciding())
+            resp_batch.push_back(ClientResp{fin, addr, batched});
+        else
+            resp_queue.enqueue(resp_batch_t{ClientResp{fin, addr, batched}});
+    };
+    uint32_t cid;
+    uint64_t seq;
+    if (client_sessions && cmd->get_session(cid, seq))
+        exec_command(cmd_hash, cid, seq, std::move(callback));
+    else
+        exec_command(cmd_hash, std::move(callback));
+}
+
+void HotStuffApp::client_request_read_handler(MsgReqRead &&msg, const conn_t &conn) {
+    const NetAddr addr = conn->get_addr();
+    uint64_t rid = msg.rid;
+    /* serve the read from the executed state, without going through
+     * consensus */
+    get_tcall().async_call([this, addr, rid](salticidae::ThreadCall::Handle &) {
+        async_read_index().then([this, addr, rid](bool ok) {
+            uint32_t height = get_b_exec()->get_height();
+            uint256_t digest = state_machine_digest();
+            resp_tcall->async_call([this, addr, rid, ok, height, digest](salticidae::ThreadCall::Handle &) {
+                try {
+                    cn.send_msg(MsgRespRead(rid, ok, height, digest), addr);
+                } catch (std::exception &err) {
+                    HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
+                }
+            });
+        });
     });
 }
 
@@ -343,11 +570,10 @@ void HotStuffApp::start(const std::vector<std::tuple<NetAddr, bytearray_t, bytea
     ev_stat_timer = TimerEvent(ec, [this](TimerEvent &) {
         HotStuff::print_stat();
         HotStuffApp::print_stat();
-        //HotStuffCore::prune(100);
         ev_stat_timer.add(stat_period);
     });
     ev_stat_timer.add(stat_period);
-    impeach_timer = TimerEvent(ec, [this](TimerEvent &) {
+    impeach_timer = hotstuff::WheelTimer(ec, [this](hotstuff::WheelTimer &) {
         if (get_decision_waiting().size())
             get_pace_maker()->impeach();
         reset_imp_timer();
@@ -382,6 +608,7 @@ void HotStuffApp::stop() {
 
     req_thread.join();
     resp_thread.join();
+    save_snapshot();
     ec.stop();
 }
 
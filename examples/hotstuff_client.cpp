@@ -16,6 +16,7 @@
  */
 
 #include <cassert>
+#include <atomic>
 #include <random>
 #include <signal.h>
 #include <sys/time.h>
@@ -34,81 +35,67 @@ using salticidae::Config;
 using hotstuff::ReplicaID;
 using hotstuff::NetAddr;
 using hotstuff::EventContext;
-using hotstuff::MsgReqCmd;
-using hotstuff::MsgRespCmd;
 using hotstuff::CommandDummy;
+using hotstuff::HotStuffClient;
+using hotstuff::CmdResult;
 using hotstuff::HotStuffError;
 using hotstuff::uint256_t;
 using hotstuff::opcode_t;
 using hotstuff::command_t;
 
 EventContext ec;
-ReplicaID proposer;
-size_t max_async_num;
+hotstuff::BoxObj<HotStuffClient> client;
+hotstuff::BoxObj<salticidae::ThreadCall> tcall;
 int max_iter_num;
 uint32_t cid;
 uint32_t cnt = 0;
-uint32_t nfaulty;
+/** the number of commands awaiting their outcomes */
+std::atomic<size_t> nwaiting(0);
 
-struct Request {
-    command_t cmd;
-    size_t confirmed;
-    salticidae::ElapsedTime et;
-    Request(const command_t &cmd): cmd(cmd), confirmed(0) { et.start(); }
-};
-
-using Net = salticidae::MsgNetwork<opcode_t>;
+#ifdef HOTSTUFF_ED25519
+using PubKeyType = hotstuff::PubKeyEd25519;
+using QuorumCertType = hotstuff::QuorumCertEd25519;
+#else
+using PubKeyType = hotstuff::PubKeySecp256k1;
+using QuorumCertType = hotstuff::QuorumCertSecp256k1;
+#endif
 
-std::unordered_map<ReplicaID, Net::conn_t> conns;
-std::unordered_map<const uint256_t, Request> waiting;
 std::vector<NetAddr> replicas;
 std::vector<std::pair<struct timeval, double>> elapsed;
-Net mn(ec, Net::Config());
 
-void connect_all() {
-    for (size_t i = 0; i < replicas.size(); i++)
-        conns.insert(std::make_pair(i, mn.connect_sync(replicas[i])));
-}
+void on_result(const CmdResult &res);
 
-bool try_send(bool check = true) {
-    if ((!check || waiting.size() < max_async_num) && max_iter_num)
-    {
-        auto cmd = new CommandDummy(cid, cnt++);
-        MsgReqCmd msg(*cmd);
-        for (auto &p: conns) mn.send_msg(msg, p.second);
+/* only called on the client thread once started */
+bool try_send() {
+    if (!max_iter_num) return false;
+    command_t cmd = new CommandDummy(cid, cnt++);
 #ifndef HOTSTUFF_ENABLE_BENCHMARK
-        HOTSTUFF_LOG_INFO("send new cmd %.10s",
-                            get_hex(cmd->get_hash()).c_str());
+    HOTSTUFF_LOG_INFO("send new cmd %.10s",
+                        get_hex(cmd->get_hash()).c_str());
 #endif
-        waiting.insert(std::make_pair(
-            cmd->get_hash(), Request(cmd)));
-        if (max_iter_num > 0)
-            max_iter_num--;
-        return true;
-    }
-    return false;
+    nwaiting++;
+    client->submit(cmd, on_result);
+    if (max_iter_num > 0)
+        max_iter_num--;
+    return true;
 }
 
-void client_resp_cmd_handler(MsgRespCmd &&msg, const Net::conn_t &) {
-    auto &fin = msg.fin;
-    HOTSTUFF_LOG_DEBUG("got %s", std::string(msg.fin).c_str());
-    const uint256_t &cmd_hash = fin.cmd_hash;
-    auto it = waiting.find(cmd_hash);
-    auto &et = it->second.et;
-    if (it == waiting.end()) return;
-    et.stop();
-    if (++it->second.confirmed <= nfaulty) return; // wait for f + 1 ack
+void on_result(const CmdResult &res) {
 #ifndef HOTSTUFF_ENABLE_BENCHMARK
-    HOTSTUFF_LOG_INFO("got %s, wall: %.3f, cpu: %.3f",
-                        std::string(fin).c_str(),
-                        et.elapsed_sec, et.cpu_elapsed_sec);
+    if (res.status == CmdResult::TIMEOUT)
+        HOTSTUFF_LOG_WARN("timed out %.10s", get_hex(res.fin.cmd_hash).c_str());
+    else
+        HOTSTUFF_LOG_INFO("got %s, wall: %.3f",
+                            std::string(res.fin).c_str(), res.elapsed);
 #else
     struct timeval tv;
     gettimeofday(&tv, nullptr);
-    elapsed.push_back(std::make_pair(tv, et.elapsed_sec));
+    elapsed.push_back(std::make_pair(tv, res.elapsed));
 #endif
-    waiting.erase(it);
-    while (try_send());
+    nwaiting--;
+    /* closed loop: one out, one in */
+    if (!try_send() && nwaiting == 0)
+        tcall->async_call([](salticidae::ThreadCall::Handle &) { ec.stop(); });
 }
 
 std::pair<std::string, std::string> split_ip_port_cport(const std::string &s) {
@@ -124,25 +111,35 @@ int main(int argc, char **argv) {
     auto opt_max_iter_num = Config::OptValInt::create(100);
     auto opt_max_async_num = Config::OptValInt::create(10);
     auto opt_cid = Config::OptValInt::create(-1);
+    auto opt_proof = Config::OptValFlag::create(false);
+    auto opt_timeout = Config::OptValDouble::create(5);
+    auto opt_retries = Config::OptValInt::create(3);
+    auto opt_batch = Config::OptValInt::create(1);
 
     auto shutdown = [&](int) { ec.stop(); };
     salticidae::SigEvent ev_sigint(ec, shutdown);
     salticidae::SigEvent ev_sigterm(ec, shutdown);
     ev_sigint.add(SIGINT);
     ev_sigterm.add(SIGTERM);
-
-    mn.reg_handler(client_resp_cmd_handler);
-    mn.start();
+    tcall = new salticidae::ThreadCall(ec);
 
     config.add_opt("idx", opt_idx, Config::SET_VAL);
     config.add_opt("cid", opt_cid, Config::SET_VAL);
     config.add_opt("replica", opt_replicas, Config::APPEND);
     config.add_opt("iter", opt_max_iter_num, Config::SET_VAL);
     config.add_opt("max-async", opt_max_async_num, Config::SET_VAL);
+    config.add_opt("proof", opt_proof, Config::SWITCH_ON);
+    config.add_opt("timeout", opt_timeout, Config::SET_VAL);
+    config.add_opt("retries", opt_retries, Config::SET_VAL);
+    config.add_opt("batch", opt_batch, Config::SET_VAL);
     config.parse(argc, argv);
     auto idx = opt_idx->get();
     max_iter_num = opt_max_iter_num->get();
-    max_async_num = opt_max_async_num->get();
+    size_t max_async_num = opt_max_async_num->get();
+    /* ask the replica `idx` for a proof instead of waiting for f + 1
+     * acknowledgements */
+    bool use_proof = opt_proof->get();
+    hotstuff::ReplicaConfig replica_config;
     std::vector<std::string> raw;
     for (const auto &s: opt_replicas->get())
     {
@@ -150,6 +147,16 @@ int main(int argc, char **argv) {
         if (res.size() < 1)
             throw HotStuffError("format error");
         raw.push_back(res[0]);
+        if (use_proof)
+        {
+            /* the public keys are needed to check the proofs */
+            if (res.size() < 2)
+                throw HotStuffError("format error");
+            ReplicaID rid = replica_config.nreplicas;
+            replica_config.add_replica(rid,
+                hotstuff::ReplicaInfo(rid, NetAddr(),
+                    new PubKeyType(hotstuff::from_hex(res[1]))));
+        }
     }
 
     if (!(0 <= idx && (size_t)idx < raw.size() && raw.size() > 0))
@@ -162,11 +169,31 @@ int main(int argc, char **argv) {
         replicas.push_back(NetAddr(NetAddr(_p.first).ip, htons(stoi(_p.second, &_))));
     }
 
-    nfaulty = (replicas.size() - 1) / 3;
+    HotStuffClient::Config client_config;
+    client_config.max_inflight = max_async_num;
+    client_config.timeout = opt_timeout->get();
+    client_config.max_retries = opt_retries->get();
+    client_config.max_batch = opt_batch->get();
+    client = new HotStuffClient(replicas, client_config);
+    size_t nfaulty = client->get_nfaulty();
     HOTSTUFF_LOG_INFO("nfaulty = %zu", nfaulty);
-    connect_all();
-    while (try_send());
+    if (use_proof)
+    {
+        replica_config.nmajority = replica_config.nreplicas - nfaulty;
+        client->set_proof(idx, replica_config,
+            [](hotstuff::DataStream &s) -> hotstuff::quorum_cert_bt {
+                hotstuff::QuorumCert *qc = new QuorumCertType();
+                s >> *qc;
+                return qc;
+            });
+    }
+    /* the first window of commands, before the callbacks could run */
+    for (size_t i = 0; i < max_async_num && try_send(); i++);
+    if (nwaiting == 0) return 0;
+    client->start();
     ec.dispatch();
+    /* joins the client thread */
+    client = nullptr;
 
 #ifdef HOTSTUFF_ENABLE_BENCHMARK
     for (const auto &e: elapsed)
@@ -0,0 +1,143 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Consume the commit feed of a replica (see `--commit-feed` of hotstuff-app),
+ * printing one line per committed block: the height, the block hash and the
+ * command hashes. The cursor is optionally kept in a file, so a restarted
+ * consumer resumes right after the last block it printed. */
+
+#include <cstdio>
+#include <fstream>
+#include <signal.h>
+
+#include "salticidae/type.h"
+#include "salticidae/netaddr.h"
+#include "salticidae/network.h"
+#include "salticidae/util.h"
+
+#include "hotstuff/util.h"
+#include "hotstuff/type.h"
+#include "hotstuff/feed.h"
+
+using salticidae::Config;
+
+using hotstuff::NetAddr;
+using hotstuff::EventContext;
+using hotstuff::TimerEvent;
+using hotstuff::MsgFeedSub;
+using hotstuff::MsgFeedAck;
+using hotstuff::MsgFeedRecords;
+using hotstuff::MsgFeedGone;
+using hotstuff::HotStuffError;
+using hotstuff::opcode_t;
+
+using Net = salticidae::MsgNetwork<opcode_t>;
+
+EventContext ec;
+Net mn(ec, Net::Config());
+NetAddr feed_addr;
+uint32_t cursor;
+uint32_t window;
+std::string cursor_file;
+TimerEvent reconn_timer;
+
+void save_cursor() {
+    if (cursor_file.empty()) return;
+    auto tmp = cursor_file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << cursor << std::endl;
+        if (!out) throw HotStuffError("cannot write %s", tmp.c_str());
+    }
+    if (rename(tmp.c_str(), cursor_file.c_str()))
+        throw HotStuffError("cannot write %s", cursor_file.c_str());
+}
+
+void feed_records_handler(MsgFeedRecords &&msg, const Net::conn_t &conn) {
+    for (const auto &rec: msg.records)
+    {
+        /* the records could be resent after resubscribing */
+        if (rec.height <= cursor) continue;
+        printf("%u %s", rec.height, get_hex(rec.blk_hash).c_str());
+        for (const auto &cmd: rec.cmds)
+            printf(" %s", get_hex(cmd).c_str());
+        printf("\n");
+        cursor = rec.height;
+    }
+    fflush(stdout);
+    save_cursor();
+    mn.send_msg(MsgFeedAck(cursor), conn);
+}
+
+void feed_gone_handler(MsgFeedGone &&msg, const Net::conn_t &) {
+    HOTSTUFF_LOG_ERROR("the blocks above %u are no longer kept by the feed "
+                        "(it starts from %u)", cursor, msg.height);
+    ec.stop();
+}
+
+int main(int argc, char **argv) {
+    Config config("hotstuff.conf");
+
+    auto opt_feed = Config::OptValStr::create("127.0.0.1:20000");
+    auto opt_cursor = Config::OptValInt::create(0);
+    auto opt_cursor_file = Config::OptValStr::create();
+    auto opt_window = Config::OptValInt::create(1024);
+
+    auto shutdown = [&](int) { ec.stop(); };
+    salticidae::SigEvent ev_sigint(ec, shutdown);
+    salticidae::SigEvent ev_sigterm(ec, shutdown);
+    ev_sigint.add(SIGINT);
+    ev_sigterm.add(SIGTERM);
+
+    mn.reg_handler(feed_records_handler);
+    mn.reg_handler(feed_gone_handler);
+    mn.reg_conn_handler([](const salticidae::ConnPool::conn_t &_conn, bool connected) {
+        auto conn = salticidae::static_pointer_cast<Net::conn_t::type>(_conn);
+        if (connected)
+            /* (re-)subscribe from where it left */
+            mn.send_msg(MsgFeedSub(cursor, window), conn);
+        else
+        {
+            HOTSTUFF_LOG_WARN("lost the feed, reconnecting");
+            reconn_timer.add(1);
+        }
+        return true;
+    });
+    mn.start();
+
+    config.add_opt("feed", opt_feed, Config::SET_VAL);
+    config.add_opt("cursor", opt_cursor, Config::SET_VAL);
+    config.add_opt("cursor-file", opt_cursor_file, Config::SET_VAL);
+    config.add_opt("window", opt_window, Config::SET_VAL);
+    config.parse(argc, argv);
+    feed_addr = NetAddr(opt_feed->get());
+    cursor = opt_cursor->get();
+    window = opt_window->get();
+    cursor_file = opt_cursor_file->get();
+    if (!cursor_file.empty())
+    {
+        std::ifstream in(cursor_file);
+        /* the file takes precedence once written */
+        if (in) in >> cursor;
+    }
+    HOTSTUFF_LOG_INFO("consuming the feed at %s from height %u",
+                        std::string(feed_addr).c_str(), cursor + 1);
+    reconn_timer = TimerEvent(ec, [](TimerEvent &) { mn.connect(feed_addr); });
+    mn.connect(feed_addr);
+    ec.dispatch();
+    return 0;
+}
@@ -0,0 +1,219 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A gateway between many clients and the replicas: it speaks the client
+ * protocol of a replica on `--listen`, forwards the commands in batches
+ * over one connection per replica (see HotStuffClient), and answers each
+ * client once f + 1 replicas agree. The replicas thus see a few
+ * connections however many clients there are, while the clients trust the
+ * gateway to check the quorum (a request for a proof is answered with a
+ * plain acknowledgement). The commands timing out are not answered, left
+ * for the clients to retry. */
+
+#include <signal.h>
+
+#include "salticidae/type.h"
+#include "salticidae/netaddr.h"
+#include "salticidae/network.h"
+#include "salticidae/util.h"
+
+#include "hotstuff/util.h"
+#include "hotstuff/type.h"
+#include "hotstuff/client.h"
+
+using salticidae::Config;
+using salticidae::ClientNetwork;
+
+using hotstuff::NetAddr;
+using hotstuff::EventContext;
+using hotstuff::TimerEvent;
+using hotstuff::MsgReqCmd;
+using hotstuff::MsgRespCmd;
+using hotstuff::MsgReqCmdBatch;
+using hotstuff::MsgRespCmdBatch;
+using hotstuff::CommandDummy;
+using hotstuff::HotStuffClient;
+using hotstuff::CmdResult;
+using hotstuff::Finality;
+using hotstuff::HotStuffError;
+using hotstuff::DataStream;
+using hotstuff::opcode_t;
+using hotstuff::command_t;
+
+using CNet = ClientNetwork<opcode_t>;
+
+struct ClientResp {
+    Finality fin;
+    NetAddr addr;
+    /** whether the client batches its commands (and the responses) */
+    bool batched;
+};
+using resp_queue_t = salticidae::MPSCQueueEventDriven<ClientResp>;
+
+EventContext ec;
+hotstuff::BoxObj<CNet> cn;
+hotstuff::BoxObj<HotStuffClient> client;
+/* the responses from the client thread */
+resp_queue_t resp_queue;
+size_t nclients = 0;
+size_t nforwarded = 0;
+TimerEvent stat_timer;
+
+static command_t parse_cmd(DataStream &s) {
+    auto cmd = new CommandDummy();
+    s >> *cmd;
+    return cmd;
+}
+
+void forward_cmd(const command_t &cmd, const NetAddr &addr,
+                uint8_t resp_mode, bool batched) {
+    nforwarded++;
+    client->submit(cmd, [addr, resp_mode, batched](const CmdResult &res) {
+        if (res.status == CmdResult::TIMEOUT ||
+            resp_mode == MsgReqCmd::RESP_NONE) return;
+        resp_queue.enqueue(ClientResp{res.fin, addr, batched});
+    });
+}
+
+void client_request_cmd_handler(MsgReqCmd &&msg, const CNet::conn_t &conn) {
+    auto cmd = parse_cmd(msg.serialized);
+    forward_cmd(cmd, conn->get_addr(), msg.parse_resp_mode(), false);
+}
+
+void client_request_cmd_batch_handler(MsgReqCmdBatch &&msg, const CNet::conn_t &conn) {
+    const NetAddr addr = conn->get_addr();
+    for (uint32_t i = 0; i < msg.ncmds; i++)
+        forward_cmd(parse_cmd(msg.serialized), addr, msg.resp_mode, true);
+}
+
+std::pair<std::string, std::string> split_ip_port_cport(const std::string &s) {
+    auto ret = salticidae::trim_all(salticidae::split(s, ";"));
+    if (ret.size() != 2)
+        throw std::invalid_argument("invalid cport format");
+    return std::make_pair(ret[0], ret[1]);
+}
+
+int main(int argc, char **argv) {
+    Config config("hotstuff.conf");
+
+    auto opt_replicas = Config::OptValStrVec::create();
+    auto opt_listen = Config::OptValStr::create("0.0.0.0:20100");
+    auto opt_max_async_num = Config::OptValInt::create(65536);
+    auto opt_batch = Config::OptValInt::create(256);
+    auto opt_timeout = Config::OptValDouble::create(5);
+    auto opt_retries = Config::OptValInt::create(3);
+    auto opt_cliburst = Config::OptValInt::create(1000);
+    auto opt_clinworker = Config::OptValInt::create(8);
+    auto opt_stat_period = Config::OptValDouble::create(10);
+
+    config.add_opt("replica", opt_replicas, Config::APPEND);
+    config.add_opt("listen", opt_listen, Config::SET_VAL);
+    config.add_opt("max-async", opt_max_async_num, Config::SET_VAL);
+    config.add_opt("batch", opt_batch, Config::SET_VAL);
+    config.add_opt("timeout", opt_timeout, Config::SET_VAL);
+    config.add_opt("retries", opt_retries, Config::SET_VAL);
+    config.add_opt("cliburst", opt_cliburst, Config::SET_VAL);
+    config.add_opt("clinworker", opt_clinworker, Config::SET_VAL);
+    config.add_opt("stat-period", opt_stat_period, Config::SET_VAL);
+    config.parse(argc, argv);
+
+    std::vector<NetAddr> replicas;
+    for (const auto &s: opt_replicas->get())
+    {
+        /* the public key (if any) is not needed */
+        auto res = salticidae::trim_all(salticidae::split(s, ","));
+        if (res.size() < 1)
+            throw HotStuffError("format error");
+        auto p = split_ip_port_cport(res[0]);
+        size_t _;
+        replicas.push_back(NetAddr(NetAddr(p.first).ip, htons(stoi(p.second, &_))));
+    }
+    if (replicas.empty())
+        throw std::invalid_argument("no replica given");
+
+    auto shutdown = [&](int) { ec.stop(); };
+    salticidae::SigEvent ev_sigint(ec, shutdown);
+    salticidae::SigEvent ev_sigterm(ec, shutdown);
+    ev_sigint.add(SIGINT);
+    ev_sigterm.add(SIGTERM);
+
+    HotStuffClient::Config client_config;
+    client_config.max_inflight = opt_max_async_num->get();
+    client_config.max_batch = opt_batch->get();
+    client_config.timeout = opt_timeout->get();
+    client_config.max_retries = opt_retries->get();
+    client = new HotStuffClient(replicas, client_config);
+
+    resp_queue.reg_handler(ec, [](resp_queue_t &q) {
+        /* the responses to a batching client go in one message */
+        std::unordered_map<NetAddr, std::vector<Finality>> fins;
+        ClientResp r;
+        while (q.try_dequeue(r))
+        {
+            if (r.batched)
+            {
+                fins[r.addr].push_back(std::move(r.fin));
+                continue;
+            }
+            try {
+                cn->send_msg(MsgRespCmd(r.fin), r.addr);
+            } catch (std::exception &err) {
+                HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
+            }
+        }
+        for (auto &p: fins)
+        {
+            try {
+                cn->send_msg(MsgRespCmdBatch(p.second), p.first);
+            } catch (std::exception &err) {
+                HOTSTUFF_LOG_WARN("unable to send to the client: %s", err.what());
+            }
+        }
+        return false;
+    });
+
+    CNet::Config clinet_config;
+    clinet_config
+        .burst_size(opt_cliburst->get())
+        .nworker(opt_clinworker->get());
+    cn = new CNet(ec, clinet_config);
+    cn->reg_handler(client_request_cmd_handler);
+    cn->reg_handler(client_request_cmd_batch_handler);
+    cn->reg_conn_handler([](const salticidae::ConnPool::conn_t &, bool connected) {
+        if (connected) nclients++;
+        else nclients--;
+        return true;
+    });
+
+    double stat_period = opt_stat_period->get();
+    stat_timer = TimerEvent(ec, [stat_period](TimerEvent &) {
+        HOTSTUFF_LOG_INFO("clients: %lu, forwarded: %lu", nclients, nforwarded);
+        nforwarded = 0;
+        stat_timer.add(stat_period);
+    });
+    stat_timer.add(stat_period);
+
+    HOTSTUFF_LOG_INFO("forwarding to %lu replicas (nfaulty = %lu)",
+                        replicas.size(), client->get_nfaulty());
+    client->start();
+    cn->start();
+    cn->listen(NetAddr(opt_listen->get()));
+    ec.dispatch();
+    /* joins the client thread before the queue goes away */
+    client = nullptr;
+    return 0;
+}
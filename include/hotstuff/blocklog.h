@@ -0,0 +1,164 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_BLOCKLOG_H
+#define _HOTSTUFF_BLOCKLOG_H
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "salticidae/event.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** Segmented, append-only log of serialized committed blocks.
+ *
+ * Each segment file (`blk-<seq>.log`) is a sequence of records, each being
+ * a 12-byte header (payload length, block height and payload checksum, all
+ * little-endian) followed by the payload. A sparse index (`blk.idx`) maps
+ * the first record of each segment and every `index_interval`-th height to
+ * its position. The index is memory-mapped. A torn tail left by a crash is
+ * detected by the checksum and truncated upon opening.
+ *
+ * The object is not thread-safe: all calls should be made from the same
+ * thread (see BlockLogWriter). */
+class BlockLog {
+    public:
+    struct Config {
+        /** roll over to a new segment beyond this size (in bytes) */
+        size_t segment_size;
+        /** index one record per this many heights */
+        uint32_t index_interval;
+        /** fdatasync() the segment upon each flush */
+        bool sync;
+        Config(): segment_size(64 << 20), index_interval(64), sync(false) {}
+    };
+
+    struct IndexEntry {
+        uint32_t height;
+        uint32_t seg;
+        uint64_t offset;
+    };
+
+    /** Sequential reader of the log, starting from a given height. */
+    class Iterator {
+        friend BlockLog;
+        const BlockLog *log;
+        uint32_t seg;
+        uint64_t offset;
+        uint32_t from_height;
+        int fd;
+        /* the size of the segment, as last seen */
+        uint64_t seg_size;
+        bytearray_t buff;
+        size_t buff_pos;
+        uint64_t buff_offset;
+
+        Iterator(const BlockLog *log, uint32_t seg, uint64_t offset,
+                uint32_t from_height);
+        bool read(uint8_t *dst, size_t len);
+        bool open_seg();
+        /** whether the segment has `len` bytes from the current record */
+        bool has_bytes(uint64_t len);
+
+        public:
+        Iterator(const Iterator &) = delete;
+        Iterator(Iterator &&other);
+        ~Iterator();
+        /** Read the next record. Throws HotStuffError if a record before
+         * the last segment is corrupted (only a torn tail is tolerated).
+         * @return false if the end of the log is reached */
+        bool next(uint32_t &height, bytearray_t &payload);
+    };
+
+    static const size_t header_size = 12;
+    /** the largest payload of a record */
+    static const size_t max_record_size = 64 << 20;
+
+    BlockLog(const std::string &dir, const Config &config = Config());
+    BlockLog(const BlockLog &) = delete;
+    ~BlockLog();
+
+    /** Append a record. The heights should be strictly increasing and the
+     * payload not larger than `max_record_size`. The record is buffered
+     * until the next flush(). */
+    void append(uint32_t height, const uint8_t *payload, size_t len);
+    void append(uint32_t height, const bytearray_t &payload) {
+        append(height, payload.data(), payload.size());
+    }
+    /** Write out all buffered records with a single write. */
+    void flush();
+
+    /** Height of the last record (0 if empty). */
+    uint32_t get_tail_height() const { return tail_height; }
+    /** Number of segments. */
+    uint32_t get_nsegments() const { return tail_seg + 1; }
+    /** Get an iterator for the records whose heights are not lower than
+     * `height`. Only the flushed records are visible. */
+    Iterator read_from(uint32_t height) const;
+
+    private:
+    const std::string dir;
+    const Config config;
+    /* segment being appended */
+    int seg_fd;
+    uint32_t tail_seg;
+    uint64_t tail_offset;
+    uint32_t tail_height;
+    uint32_t last_indexed;
+    bytearray_t pending;
+    /* memory-mapped sparse index */
+    int idx_fd;
+    IndexEntry *idx;
+    size_t idx_size;
+    size_t idx_cap;
+
+    std::string seg_path(uint32_t seg) const;
+    void open_seg(uint32_t seg);
+    void map_index(size_t cap);
+    void add_index(uint32_t height, uint32_t seg, uint64_t offset);
+    void recover();
+};
+
+/** Runs a BlockLog on a dedicated thread, so the appends (and the disk
+ * writes) are batched off the event loop of the caller. */
+class BlockLogWriter {
+    using queue_t = salticidae::MPSCQueueEventDriven<std::pair<uint32_t, bytearray_t>>;
+    BlockLog log;
+    EventContext ec;
+    queue_t queue;
+    BoxObj<salticidae::ThreadCall> tcall;
+    std::thread handle;
+
+    public:
+    BlockLogWriter(const std::string &dir,
+                const BlockLog::Config &config = BlockLog::Config(),
+                size_t burst_size = 128);
+    ~BlockLogWriter();
+
+    /** Enqueue a serialized block, could be called from any thread. */
+    void append(uint32_t height, bytearray_t &&payload) {
+        queue.enqueue(std::make_pair(height, std::move(payload)));
+    }
+};
+
+}
+
+#endif
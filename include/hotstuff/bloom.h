@@ -0,0 +1,66 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_BLOOM_H
+#define _HOTSTUFF_BLOOM_H
+
+#include <vector>
+#include <cstdint>
+
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** Bloom filter remembering the hashes inserted within a window of heights,
+ * in bounded memory. It has two generations: the hashes go into the current
+ * one, which becomes the previous one (and the previous one is dropped) once
+ * it spans `window` heights. A hash is thus remembered for at least `window`
+ * heights (and at most twice as long). There are no false negatives within
+ * the window, but a hash never inserted could be reported with probability
+ * around `fp_rate`. */
+class RotatingBloomFilter {
+    std::vector<uint64_t> gens[2];
+    size_t nbits;
+    uint32_t nhashes;
+    uint32_t window;
+    /** the index of the current generation */
+    uint8_t cur;
+    /** the height at which the current generation started */
+    uint32_t cur_start;
+    bool started;
+
+    void rotate(uint32_t height);
+
+    public:
+    /** Keep up to `capacity` hashes in each generation (i.e., the expected
+     * number of insertions per `window` heights) with a false positive rate
+     * of `fp_rate`. */
+    RotatingBloomFilter(size_t capacity, double fp_rate, uint32_t window);
+
+    /** Insert a hash seen at `height`, which should not decrease between
+     * the calls. */
+    void insert(const uint256_t &hash, uint32_t height);
+    bool contains(const uint256_t &hash) const;
+    void clear();
+
+    /** The memory taken by the bits (in bytes). */
+    size_t get_size() const { return 2 * gens[0].size() * sizeof(uint64_t); }
+};
+
+}
+
+#endif
@@ -17,7 +17,15 @@
 #ifndef _HOTSTUFF_CLIENT_H
 #define _HOTSTUFF_CLIENT_H
 
+#include <deque>
+#include <future>
+#include <thread>
+#include <functional>
+#include <unordered_map>
+
 #include "salticidae/msg.h"
+#include "salticidae/event.h"
+#include "salticidae/network.h"
 #include "hotstuff/type.h"
 #include "hotstuff/entity.h"
 #include "hotstuff/consensus.h"
@@ -26,10 +34,26 @@ namespace hotstuff {
 
 struct MsgReqCmd {
     static const opcode_t opcode = 0x4;
+    /** how the replica should respond once the command is committed */
+    enum RespMode: uint8_t {
+        RESP_NONE = 0,
+        RESP_ACK = 1,   /**< with MsgRespCmd (the default) */
+        RESP_PROOF = 2  /**< with MsgRespProof, if a proof can be made */
+    };
     DataStream serialized;
     command_t cmd;
-    MsgReqCmd(const Command &cmd) { serialized << cmd; }
+    MsgReqCmd(const Command &cmd, uint8_t resp_mode = RESP_ACK) {
+        serialized << cmd;
+        /* omitted for compatibility */
+        if (resp_mode != RESP_ACK) serialized << resp_mode;
+    }
     MsgReqCmd(DataStream &&s): serialized(std::move(s)) {}
+    /** Get the response mode, following the command in `serialized`. */
+    uint8_t parse_resp_mode() {
+        uint8_t resp_mode = RESP_ACK;
+        if (serialized.size()) serialized >> resp_mode;
+        return resp_mode;
+    }
 };
 
 struct MsgRespCmd {
@@ -50,6 +74,89 @@ struct MsgRespCmd {
     }
 };
 
+/** A response carrying the proof of the commit, so the client needs no
+ * other confirmation. */
+struct MsgRespProof {
+    static const opcode_t opcode = 0xf;
+    DataStream serialized;
+    Finality fin;
+    CommitProof proof;
+    MsgRespProof(const Finality &fin, const CommitProof &proof) {
+        serialized << fin << proof;
+    }
+    MsgRespProof(DataStream &&s) {
+        s >> fin >> proof;
+    }
+};
+
+/** A batch of commands in one frame (e.g., from a gateway), answered with
+ * MsgRespCmdBatch (or MsgRespProof) per committed block. */
+struct MsgReqCmdBatch {
+    static const opcode_t opcode = 0x12;
+    DataStream serialized;
+    uint8_t resp_mode;
+    uint32_t ncmds;
+    /** Batch the commands in [begin, end), of command_t. */
+    template<typename It>
+    MsgReqCmdBatch(It begin, It end, uint8_t resp_mode = MsgReqCmd::RESP_ACK) {
+        serialized << resp_mode << htole((uint32_t)(end - begin));
+        for (auto it = begin; it != end; it++) serialized << **it;
+    }
+    /** The `ncmds` commands are left in `serialized`. */
+    MsgReqCmdBatch(DataStream &&s): serialized(std::move(s)) {
+        serialized >> resp_mode >> ncmds;
+        ncmds = letoh(ncmds);
+    }
+};
+
+struct MsgRespCmdBatch {
+    static const opcode_t opcode = 0x13;
+    DataStream serialized;
+    std::vector<Finality> fins;
+    MsgRespCmdBatch(const std::vector<Finality> &fins) {
+        serialized << htole((uint32_t)fins.size());
+        for (const auto &fin: fins) serialized << fin;
+    }
+    MsgRespCmdBatch(DataStream &&s) {
+        uint32_t n;
+        s >> n;
+        fins.resize(letoh(n));
+        for (auto &fin: fins) s >> fin;
+    }
+};
+
+/** A linearizable read of the replicated state. */
+struct MsgReqRead {
+    static const opcode_t opcode = 0xb;
+    DataStream serialized;
+    uint64_t rid;
+    MsgReqRead(uint64_t rid) { serialized << htole(rid); }
+    MsgReqRead(DataStream &&s) {
+        s >> rid;
+        rid = letoh(rid);
+    }
+};
+
+struct MsgRespRead {
+    static const opcode_t opcode = 0xc;
+    DataStream serialized;
+    uint64_t rid;
+    /** false if the read could not be confirmed in time */
+    uint8_t ok;
+    /** the executed height and the state digest the read is served from */
+    uint32_t height;
+    uint256_t state_digest;
+    MsgRespRead(uint64_t rid, bool ok, uint32_t height,
+                const uint256_t &state_digest) {
+        serialized << htole(rid) << (uint8_t)ok << htole(height) << state_digest;
+    }
+    MsgRespRead(DataStream &&s) {
+        s >> rid >> ok >> height >> state_digest;
+        rid = letoh(rid);
+        height = letoh(height);
+    }
+};
+
 //#ifdef HOTSTUFF_AUTOCLI
 //struct MsgDemandCmd {
 //    static const opcode_t opcode = 0x6;
@@ -98,6 +205,178 @@ class CommandDummy: public Command {
     bool verify() const override {
         return true;
     }
+
+    /** The n-th command of client cid. */
+    bool get_session(uint32_t &_cid, uint64_t &seq) const override {
+        _cid = cid;
+        seq = n;
+        return true;
+    }
+};
+
+/** The outcome of a command submitted through HotStuffClient. */
+struct CmdResult {
+    enum Status: uint8_t {
+        COMMITTED,  /**< confirmed by f + 1 replicas (or by a proof) */
+        REJECTED,   /**< rejected (e.g., as a replay) by f + 1 replicas */
+        TIMEOUT     /**< no decision after all the retries (it may still be
+                         committed, see HotStuffClient) */
+    };
+    Status status;
+    /** the decision that completed the quorum (or the proof) */
+    Finality fin;
+    /** the wall time since the submission (in seconds) */
+    double elapsed;
+
+    CmdResult(Status status, const Finality &fin, double elapsed):
+        status(status), fin(fin), elapsed(elapsed) {}
+};
+
+/** An asynchronous client of the replicas, to be embedded in applications.
+ * It keeps a connection to every replica (reconnecting the lost ones), and
+ * pipelines up to `max_inflight` commands, queueing the others. A command
+ * is sent to all the connected replicas, since any of them could be the
+ * next proposer, and completes once f + 1 of them agree on its decision.
+ * Unanswered commands are resent every `timeout` seconds, `max_retries`
+ * times at most. The new commands could also be sent in batches, which
+ * the replicas answer per committed block.
+ *
+ * A retry is the same command sent again, and it may have been committed
+ * meanwhile. Without the replay filter (see
+ * `HotStuffBase::set_replay_filter()`), the replicas propose it again, so
+ * it may be executed twice. With the filter, they reject the retry
+ * (decision 0) just as a replica still deciding the first attempt does, so
+ * the rejections after a retry are ignored, and the command ends as
+ * TIMEOUT even if it has been committed. The client sessions (see
+ * `HotStuffBase::exec_command()`) only answer the retry of the last
+ * command of a client with its cached reply. So TIMEOUT means an unknown
+ * outcome, and `max_retries` should be 0 for the commands that are not
+ * idempotent, unless their outcome is checked (e.g., by a read) before
+ * submitting them again.
+ *
+ * The client runs on a dedicated thread: the commands could be submitted
+ * from any thread, while the callbacks are invoked on the client thread
+ * (and should not block it). */
+class HotStuffClient {
+    public:
+    using Net = salticidae::MsgNetwork<opcode_t>;
+    using callback_t = std::function<void(const CmdResult &)>;
+    using qc_parser_t = std::function<quorum_cert_bt(DataStream &)>;
+
+    struct Config {
+        /** the maximum number of commands awaiting their decisions */
+        size_t max_inflight;
+        /** the time (in seconds) to wait for a decision before resending */
+        double timeout;
+        /** the number of resends (see the caveats above) */
+        uint32_t max_retries;
+        /** the maximum number of commands sent in one MsgReqCmdBatch (1
+         * for sending them one by one) */
+        size_t max_batch;
+        Net::Config net_config;
+        Config(): max_inflight(1024), timeout(5), max_retries(3), max_batch(1) {}
+    };
+
+    private:
+    struct Submission {
+        command_t cmd;
+        callback_t callback;
+    };
+    struct Request {
+        command_t cmd;
+        /** all the submissions of the same command */
+        std::vector<callback_t> callbacks;
+        /** the decisions received, one per replica */
+        std::unordered_map<ReplicaID, Finality> resps;
+        uint32_t retries;
+        salticidae::ElapsedTime et;
+        /** when the command was last sent (in `et` seconds) */
+        double sent;
+        /** whether it has been sent to each replica */
+        std::vector<bool> sent_to;
+    };
+    using queue_t = salticidae::MPSCQueueEventDriven<Submission>;
+
+    Config config;
+    std::vector<NetAddr> replicas;
+    size_t nfaulty;
+    EventContext ec;
+    queue_t queue;
+    Net net;
+    /** the established connection to each replica (or null) */
+    std::vector<Net::conn_t> conns;
+    /** whether a connection to each replica is established or underway */
+    std::vector<bool> connecting;
+    std::unordered_map<Net::conn_t, ReplicaID> conn_rid;
+    std::unordered_map<const uint256_t, Request> inflight;
+    /** the commands waiting for a slot */
+    std::deque<Submission> pending;
+    /** the new commands to be sent in the next batch */
+    std::vector<command_t> batch;
+    /** times out the requests and reconnects the lost replicas */
+    TimerEvent tick_timer;
+    /** ask the replica `proof_idx` for a commit proof (verified against
+     * `replica_config`) instead of the acknowledgements */
+    bool use_proof;
+    ReplicaID proof_idx;
+    ReplicaConfig replica_config;
+    qc_parser_t parse_qc;
+    BoxObj<salticidae::ThreadCall> tcall;
+    std::thread handle;
+
+    void on_submit(Submission &&sub);
+    uint8_t get_resp_mode(const Request &req, ReplicaID rid) const;
+    void send_cmd(Request &req, ReplicaID rid);
+    void broadcast_cmd(Request &req);
+    void flush_batch();
+    void on_resp(const Finality &fin, ReplicaID rid);
+    void connect(ReplicaID rid);
+    void on_tick();
+    void finish(std::unordered_map<const uint256_t, Request>::iterator it,
+                CmdResult::Status status, const Finality &fin);
+    void resp_cmd_handler(MsgRespCmd &&, const Net::conn_t &);
+    void resp_cmd_batch_handler(MsgRespCmdBatch &&, const Net::conn_t &);
+    void resp_proof_handler(MsgRespProof &&, const Net::conn_t &);
+
+    public:
+    /** Connect to the client ports of `replicas` (in the order of their
+     * ids). */
+    HotStuffClient(const std::vector<NetAddr> &replicas,
+                    const Config &config);
+    HotStuffClient(const std::vector<NetAddr> &replicas):
+        HotStuffClient(replicas, Config()) {}
+    HotStuffClient(const HotStuffClient &) = delete;
+    /** Stop the client, the pending callbacks are dropped. */
+    ~HotStuffClient();
+
+    /** Ask the replica `rid` for a proof of the commit rather than waiting
+     * for f + 1 acknowledgements (see MsgRespProof), falling back to the
+     * acknowledgements upon retrying. Should be called before `start()`. */
+    void set_proof(ReplicaID rid, const ReplicaConfig &config, qc_parser_t parse_qc) {
+        use_proof = true;
+        proof_idx = rid;
+        replica_config = config;
+        this->parse_qc = std::move(parse_qc);
+    }
+
+    /** Connect to the replicas and start the client thread. */
+    void start();
+
+    /** Submit a command, `callback` is invoked on the client thread with
+     * its outcome. Could be called from any thread. */
+    void submit(const command_t &cmd, callback_t callback) {
+        queue.enqueue(Submission{cmd, std::move(callback)});
+    }
+
+    /** Submit a command, with a future of its outcome. */
+    std::future<CmdResult> submit(const command_t &cmd) {
+        auto pm = std::make_shared<std::promise<CmdResult>>();
+        auto fut = pm->get_future();
+        submit(cmd, [pm](const CmdResult &res) { pm->set_value(res); });
+        return fut;
+    }
+
+    size_t get_nfaulty() const { return nfaulty; }
 };
 
 }
@@ -0,0 +1,63 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_COMPRESS_H
+#define _HOTSTUFF_COMPRESS_H
+
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** The largest message accepted for decompression. */
+const size_t max_decompressed_size = 64 << 20;
+
+/** Message payload compression (zstd), optionally with a shared dictionary
+ * trained on typical payloads (`zstd --train`). Requires the library to be
+ * built with HOTSTUFF_COMPRESSION, otherwise the constructor throws. */
+class Compressor {
+    /* opaque zstd contexts and dictionaries */
+    void *cctx;
+    void *dctx;
+    void *cdict;
+    void *ddict;
+    int level;
+    uint256_t dict_hash;
+
+    public:
+    Compressor(int level = 3, const bytearray_t &dict = bytearray_t());
+    Compressor(const Compressor &) = delete;
+    ~Compressor();
+
+    /** Whether the library is built with the compression. */
+    static bool is_supported();
+    /** The hash of the dictionary (zero if none), for the peers to check
+     * that they use the same one. */
+    const uint256_t &get_dict_hash() const { return dict_hash; }
+
+    /** Compress `size` bytes of `data` into `out`.
+     * @return false if the result is not smaller than the input */
+    bool compress(const uint8_t *data, size_t size, bytearray_t &out);
+    /** Decompress into `out`, which should result in `raw_size` bytes.
+     * Throws HotStuffError on malformed input, or if it was compressed
+     * with a dictionary other than the local one. */
+    void decompress(const uint8_t *data, size_t size, size_t raw_size,
+                    bytearray_t &out);
+};
+
+}
+
+#endif
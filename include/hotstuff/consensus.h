@@ -20,7 +20,11 @@
 
 #include <cassert>
 #include <set>
+#include <queue>
+#include <stack>
+#include <functional>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "hotstuff/promise.hpp"
 #include "hotstuff/type.h"
@@ -32,6 +36,53 @@ namespace hotstuff {
 struct Proposal;
 struct Vote;
 struct Finality;
+struct BlockFinality;
+struct CommitProof;
+struct CheckpointVote;
+
+#ifndef HOTSTUFF_TWO_STEP
+/** the number of blocks directly extending a block which commit it */
+const size_t commit_depth = 2;
+#else
+const size_t commit_depth = 1;
+#endif
+
+/** Summary of the replicated state after executing a block. */
+struct Checkpoint: public Serializable {
+    /** height of the last executed block */
+    uint32_t height;
+    /** hash of the last executed block */
+    uint256_t blk_hash;
+    /** digest of the application state */
+    uint256_t state_digest;
+
+    Checkpoint(): height(0) {}
+    Checkpoint(uint32_t height,
+            const uint256_t &blk_hash,
+            const uint256_t &state_digest):
+        height(height), blk_hash(blk_hash),
+        state_digest(state_digest) {}
+
+    void serialize(DataStream &s) const override {
+        s << height << blk_hash << state_digest;
+    }
+
+    void unserialize(DataStream &s) override {
+        s >> height >> blk_hash >> state_digest;
+    }
+
+    /** The digest signed by the replicas. */
+    uint256_t get_hash() const { return salticidae::get_hash(*this); }
+
+    operator std::string () const {
+        DataStream s;
+        s << "<ckpt "
+          << "height=" << std::to_string(height) << " "
+          << "blk=" << get_hex10(blk_hash) << " "
+          << "state=" << get_hex10(state_digest) << ">";
+        return std::move(s);
+    }
+};
 
 /** Abstraction for HotStuff protocol state machine (without network implementation). */
 class HotStuffCore {
@@ -42,6 +93,8 @@ class HotStuffCore {
     block_t b_lock;                            /**< locked block */
     block_t b_exec;                            /**< last executed block */
     uint32_t vheight;          /**< height of the block last voted for */
+    /** height of a restored lock whose block is unknown */
+    uint32_t lock_floor;
     /* === auxilliary variables === */
     privkey_bt priv_key;            /**< private key for signing votes */
     std::set<block_t> tails;   /**< set of tail blocks */
@@ -54,15 +107,56 @@ class HotStuffCore {
     /* == feature switches == */
     /** always vote negatively, useful for some PaceMakers */
     bool vote_disabled;
+    /* === pruning === */
+    /** number of committed blocks kept below b_exec (0 to disable) */
+    uint32_t prune_staleness;
+    /** committed blocks not yet stale enough to be pruned */
+    std::queue<block_t> prune_window;
+    /** pending DFS work for releasing the committed chain */
+    std::stack<block_t> prune_stack;
+    /** tails of dead fork branches waiting to be released (still in tails
+     * until then), each queued once */
+    std::unordered_set<block_t> prune_forks;
+    uint64_t npruned;
+    /* === checkpointing === */
+    struct CheckpointContext {
+        Checkpoint ckpt;
+        quorum_cert_bt qc;
+        std::unordered_set<ReplicaID> voted;
+        CheckpointContext(const Checkpoint &ckpt, quorum_cert_bt &&qc):
+            ckpt(ckpt), qc(std::move(qc)) {}
+    };
+    /** checkpoint every this many committed blocks (0 to disable) */
+    uint32_t ckpt_period;
+    /** the latest checkpoint certified by a quorum */
+    std::pair<Checkpoint, quorum_cert_bt> stable_ckpt;
+    /** checkpoints being voted, keyed by their digests */
+    std::unordered_map<const uint256_t, CheckpointContext> ckpt_waiting;
+    /** the pending checkpoint each replica last voted for */
+    std::unordered_map<ReplicaID, uint256_t> ckpt_voted;
+    /** the blocks extending b_exec which committed it, and the QC for the
+     * last of them */
+    std::pair<std::vector<block_t>, quorum_cert_bt> commit_proof;
+    /** the highest committed block whose execution waits for the body of a
+     * block (received by its header) up to it */
+    block_t commit_pending;
+    /** the command tree of the block last proven by `prove_commit()` */
+    mutable std::pair<uint256_t, MerkleTree> cmd_tree_cache;
 
     block_t get_delivered_blk(const uint256_t &blk_hash);
     void sanity_check_delivered(const block_t &blk);
     void update(const block_t &nblk);
+    /** execute the blocks from b_exec (exclusive) up to blk, stopping
+     * before the first block without its body */
+    void commit(const block_t &blk);
     void update_hqc(const block_t &_hqc, const quorum_cert_bt &qc);
     void on_hqc_update();
     void on_qc_finish(const block_t &blk);
     void on_propose_(const Proposal &prop);
     void on_receive_proposal_(const Proposal &prop);
+    void schedule_prune();
+    void release_fork(block_t blk);
+    void on_checkpoint(const block_t &blk);
 
     protected:
     ReplicaID id;                  /**< identity of the replica itself */
@@ -82,6 +176,24 @@ class HotStuffCore {
      * functions. */
     void on_init(uint32_t nfaulty);
 
+    /** Write a compact snapshot of the live part of the block DAG (b_exec
+     * and the blocks extending it) together with hqc, b_lock, vheight, tails,
+     * the stable checkpoint and the state of the user (see
+     * `do_save_snapshot()`).
+     * @return false if a live block still waits for its body */
+    bool save_snapshot(DataStream &s) const;
+    /** Restore the state written by `save_snapshot()`, without re-running
+     * the delivery of the blocks. Should be called right after `on_init()`.
+     * The state is left untouched if the snapshot is ill-formed. */
+    void load_snapshot(DataStream &s);
+    /** Restore the vote state recorded by `do_persist_vote()`, which may be
+     * newer than the snapshot: the replica never votes again at or below
+     * `vheight`, and adopts the lock if its block is known (otherwise, it
+     * only votes for the blocks whose QC is above `lock_height` until it
+     * locks again). Should be called after `load_snapshot()`. */
+    void restore_vote_state(uint32_t vheight, const uint256_t &lock_hash,
+                            uint32_t lock_height);
+
     /* TODO: better name for "delivery" ? */
     /** Call to inform the state machine that a block is ready to be handled.
      * A block is only delivered if itself is fetched, the block for the
@@ -99,6 +211,22 @@ class HotStuffCore {
      * The block mentioned in the message should be already delivered. */
     void on_receive_vote(const Vote &vote);
 
+    /** Call upon learning that a block is committed, without taking part in
+     * the consensus (e.g., in a learner). The block should be delivered, and
+     * the caller is responsible for checking its commit proof (see
+     * `get_commit_proof()` and `check_commit_chain()`). */
+    void on_receive_committed(const block_t &blk);
+
+    /** Call upon the arrival of the body of a block received by its header,
+     * to resume the execution of the committed blocks waiting for it. */
+    void on_receive_body(const block_t &blk);
+
+    /** Call upon the delivery of a checkpoint vote message. The vote should
+     * have been verified. To bound the pending checkpoints, the votes far
+     * above b_exec are ignored and only the highest pending vote of each
+     * replica is kept. */
+    void on_receive_checkpoint(const CheckpointVote &vote);
+
     /** Call to submit new commands to be decided (executed). "Parents" must
      * contain at least one block, and the first block is the actual parent,
      * while the others are uncles/aunts */
@@ -113,8 +241,9 @@ class HotStuffCore {
      * functions should be implemented by the user to specify the behavior upon
      * the events. */
     protected:
-    /** Called by HotStuffCore upon the decision being made for cmd. */
-    virtual void do_decide(Finality &&fin) = 0;
+    /** Called by HotStuffCore upon the decision being made for the commands
+     * in a committed block (once per block). */
+    virtual void do_decide(const BlockFinality &bfin) = 0;
     virtual void do_consensus(const block_t &blk) = 0;
     /** Called by HotStuffCore upon broadcasting a new proposal.
      * The user should send the proposal message to all replicas except for
@@ -124,12 +253,49 @@ class HotStuffCore {
      * should send the vote message to a *good* proposer to have good liveness,
      * while safety is always guaranteed by HotStuffCore. */
     virtual void do_vote(ReplicaID last_proposer, const Vote &vote) = 0;
+    /** Called by HotStuffCore when new pruning work is queued after a
+     * commit. The user should call `prune_step()` (possibly over several
+     * event loop iterations) to carry it out. */
+    virtual void do_prune() {}
+    /** Called by HotStuffCore to get the digest of the application state
+     * right after executing a checkpoint block. */
+    virtual uint256_t do_state_digest() { return uint256_t(); }
+    /** Called by HotStuffCore upon signing a new checkpoint. The user should
+     * send the vote to all replicas except for itself. */
+    virtual void do_broadcast_checkpoint(const CheckpointVote &) {}
+    /** Called by HotStuffCore when a checkpoint is certified by a quorum.
+     * Everything older than the checkpoint can be safely garbage collected
+     * by the user. */
+    virtual void do_checkpoint(const Checkpoint &, const QuorumCert &) {}
+    /** Called by HotStuffCore to append the state of the user matching
+     * b_exec (e.g., the digest of the executed commands) to a snapshot. */
+    virtual void do_save_snapshot(DataStream &) const {}
+    /** Called by HotStuffCore to read back what `do_save_snapshot()` wrote,
+     * once the rest of the snapshot is parsed. It should throw, leaving its
+     * state untouched, if that is ill-formed. */
+    virtual void do_load_snapshot(DataStream &) {}
+    /** Called by HotStuffCore right before a vote for a block at `vheight`
+     * (including the self-vote of a proposer) leaves the replica. The user
+     * should durably record the vote state, so that a restarted replica
+     * never votes twice at the same height (see `restore_vote_state()`).
+     * @return false if it cannot be recorded, so that the vote is withheld */
+    virtual bool do_persist_vote(uint32_t vheight, const block_t &lock) {
+        (void)vheight; (void)lock;
+        return true;
+    }
 
     /* The user plugs in the detailed instances for those
      * polymorphic data types. */
     public:
     /** Create a partial certificate that proves the vote for a block. */
     virtual part_cert_bt create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) = 0;
+    /** Create a partial certificate asynchronously. The returned promise is
+     * resolved with a `PartCert *` owned by the receiver. By default, it is
+     * created right away with `create_part_cert()`. */
+    virtual promise_t async_create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) {
+        PartCert *pc = create_part_cert(priv_key, blk_hash).unwrap();
+        return promise_t([pc](promise_t &pm) { pm.resolve(pc); });
+    }
     /** Create a partial certificate from its seralized form. */
     virtual part_cert_bt parse_part_cert(DataStream &s) = 0;
     /** Create a quorum certificate that proves 2f+1 votes for a block. */
@@ -145,6 +311,18 @@ class HotStuffCore {
     void add_replica(ReplicaID rid, const NetAddr &addr, pubkey_bt &&pub_key);
     /** Try to prune blocks lower than last committed height - staleness. */
     void prune(uint32_t staleness);
+    /** Enable automatic pruning upon each commit, keeping `staleness`
+     * committed blocks below b_exec (0 disables it). */
+    void set_prune_staleness(uint32_t staleness) { prune_staleness = staleness; }
+    /** Carry out the queued pruning work for at most `budget` seconds (no
+     * limit if `budget` is not positive).
+     * @return true if there is still work left */
+    bool prune_step(double budget);
+    /** Enable periodic checkpoints at every `period` committed blocks (0
+     * disables it). When enabled, pruning never goes beyond the latest
+     * certified checkpoint. */
+    void set_ckpt_period(uint32_t period) { ckpt_period = period; }
+    uint32_t get_ckpt_period() const { return ckpt_period; }
 
     /* PaceMaker can use these functions to monitor the core protocol state
      * transition */
@@ -160,9 +338,32 @@ class HotStuffCore {
     /* Other useful functions */
     const block_t &get_genesis() const { return b0; }
     const block_t &get_hqc() { return hqc.first; }
+    /** Get the last executed block. */
+    const block_t &get_b_exec() const { return b_exec; }
+    /** Get the height of the block last voted for. */
+    uint32_t get_vheight() const { return vheight; }
+    /** Get the proof that the last committed block is committed: the chain
+     * of blocks directly extending it (two in three-step HotStuff, one in
+     * two-step), and a QC for the last of them. The committed block is
+     * b_exec unless its execution waits for a body. The QC is null before
+     * the first commit. */
+    const std::pair<std::vector<block_t>, quorum_cert_bt> &get_commit_proof() const { return commit_proof; }
+    /** Prove to a client that the command in `fin` is committed, extending
+     * the latest commit proof down to its block.
+     * @return false if the block is no longer (or not yet) reachable */
+    bool prove_commit(const Finality &fin, CommitProof &proof) const;
     const ReplicaConfig &get_config() const { return config; }
     ReplicaID get_id() const { return id; }
     const std::set<block_t> get_tails() const { return tails; }
+    /** Get the number of blocks still kept in memory. */
+    size_t get_nretained() const { return storage->get_blk_cache_size(); }
+    /** Get the total number of blocks released by pruning. */
+    uint64_t get_npruned() const { return npruned; }
+    /** Get the latest certified checkpoint and its certificate (null before
+     * the first one is certified). */
+    const std::pair<Checkpoint, quorum_cert_bt> &get_stable_ckpt() const { return stable_ckpt; }
+    /** Get the number of pending pruning work items. */
+    size_t get_prune_pending() const { return prune_stack.size() + prune_forks.size(); }
     operator std::string () const;
     void set_vote_disabled(bool f) { vote_disabled = f; }
 };
@@ -265,6 +466,66 @@ struct Vote: public Serializable {
     }
 };
 
+/** Abstraction for checkpoint vote messages. */
+struct CheckpointVote: public Serializable {
+    ReplicaID voter;
+    /** checkpoint being voted */
+    Checkpoint ckpt;
+    /** proof of validity for the vote */
+    part_cert_bt cert;
+
+    /** handle of the core object to allow polymorphism */
+    HotStuffCore *hsc;
+
+    CheckpointVote(): cert(nullptr), hsc(nullptr) {}
+    CheckpointVote(ReplicaID voter,
+        const Checkpoint &ckpt,
+        part_cert_bt &&cert,
+        HotStuffCore *hsc):
+        voter(voter),
+        ckpt(ckpt),
+        cert(std::move(cert)), hsc(hsc) {}
+
+    CheckpointVote(const CheckpointVote &other):
+        voter(other.voter),
+        ckpt(other.ckpt),
+        cert(other.cert ? other.cert->clone() : nullptr),
+        hsc(other.hsc) {}
+
+    CheckpointVote(CheckpointVote &&other) = default;
+
+    void serialize(DataStream &s) const override {
+        s << voter << ckpt << *cert;
+    }
+
+    void unserialize(DataStream &s) override {
+        assert(hsc != nullptr);
+        s >> voter >> ckpt;
+        cert = hsc->parse_part_cert(s);
+    }
+
+    bool verify() const {
+        assert(hsc != nullptr);
+        return cert->verify(hsc->get_config().get_pubkey(voter)) &&
+                cert->get_obj_hash() == ckpt.get_hash();
+    }
+
+    promise_t verify(VeriPool &vpool) const {
+        assert(hsc != nullptr);
+        return cert->verify(hsc->get_config().get_pubkey(voter), vpool).then([this](bool result) {
+            return result && cert->get_obj_hash() == ckpt.get_hash();
+        });
+    }
+
+    operator std::string () const {
+        DataStream s;
+        s << "<ckpt-vote "
+          << "rid=" << std::to_string(voter) << " "
+          << "ckpt=" << std::string(ckpt) << ">";
+        return std::move(s);
+    }
+};
+
 struct Finality: public Serializable {
     ReplicaID rid;
     int8_t decision;
@@ -311,6 +572,73 @@ struct Finality: public Serializable {
     }
 };
 
+/** The finalities of all commands in a committed block, handed over at
+ * once instead of one Finality per command. */
+struct BlockFinality {
+    ReplicaID rid;
+    uint32_t height;
+    uint256_t blk_hash;
+    /** the commands in the block, in order */
+    const std::vector<uint256_t> &cmds;
+
+    BlockFinality(ReplicaID rid,
+                uint32_t height,
+                const uint256_t &blk_hash,
+                const std::vector<uint256_t> &cmds):
+        rid(rid), height(height), blk_hash(blk_hash), cmds(cmds) {}
+
+    size_t size() const { return cmds.size(); }
+
+    /** Get the finality of the `idx`-th command. */
+    Finality get(uint32_t idx) const {
+        return Finality(rid, 1, idx, height, cmds[idx], blk_hash);
+    }
+};
+
+/** The hashes by which a block refers to the blocks below it. */
+struct BlockLink {
+    uint256_t hash;
+    /** the first parent */
+    uint256_t parent;
+    /** the block certified by the QC in the block (null if none) */
+    uint256_t qc_ref;
+
+    BlockLink() = default;
+    BlockLink(const Block &blk);
+};
+
+/** Check that a chain of blocks (in height order) commits the block
+ * `commit_depth` from its end, given a valid QC for `qc_ref`. As required by
+ * `HotStuffCore::update()`, each block should be the first parent of the
+ * next one, each of the last `commit_depth` blocks should carry a QC for the
+ * one before it, and `qc_ref` should be the last block. The QCs themselves
+ * are not verified. */
+bool check_commit_chain(const std::vector<BlockLink> &chain, const uint256_t &qc_ref);
+
+/** A self-contained proof that a command is committed, which a client can
+ * check with only the public keys of the replicas. */
+struct CommitProof: public Serializable {
+    /** inclusion of the command in the first block */
+    MerkleProof cmd_proof;
+    /** the serialized block headers, starting from the one containing the
+     * command, each being the first parent of the next one */
+    std::vector<bytearray_t> blks;
+    /** the serialized QC for the last block */
+    bytearray_t qc;
+
+    void serialize(DataStream &s) const override;
+    void unserialize(DataStream &s) override;
+
+    /** Check that the command in `fin` is committed as it claims: the last
+     * blocks form a chain of the commit depth certified by `qc`, and the
+     * command is at `fin.cmd_idx` in `fin.blk_hash`, an ancestor (or the
+     * base) of the chain. `fin.cmd_height` is not covered by the headers,
+     * so it is left unchecked. `parse_qc` parses a QC of the type used by
+     * the replicas. */
+    bool verify(const Finality &fin, const ReplicaConfig &config,
+                const std::function<quorum_cert_bt(DataStream &)> &parse_qc) const;
+};
+
 }
 
 #endif
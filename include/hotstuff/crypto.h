@@ -18,6 +18,7 @@
 #define _HOTSTUFF_CRYPTO_H
 
 #include <openssl/rand.h>
+#include <openssl/evp.h>
 
 #include "secp256k1.h"
 #include "salticidae/crypto.h"
@@ -48,6 +49,8 @@ using privkey_bt = BoxObj<PrivKey>;
 class PartCert: public Serializable, public Cloneable {
     public:
     virtual ~PartCert() = default;
+    /** Verify asynchronously. The public key should outlive the
+     * verification (the keys in ReplicaConfig always do). */
     virtual promise_t verify(const PubKey &pubkey, VeriPool &vpool) = 0;
     virtual bool verify(const PubKey &pubkey) = 0;
     virtual const uint256_t &get_obj_hash() const = 0;
@@ -329,9 +332,12 @@ class SigSecp256k1: public Serializable {
     }
 };
 
+/* The verification tasks refer to the public keys (parsed once when they
+ * are added to ReplicaConfig) instead of copying them for each signature. */
+
 class Secp256k1VeriTask: public VeriTask {
     uint256_t msg;
-    PubKeySecp256k1 pubkey;
+    const PubKeySecp256k1 &pubkey;
     SigSecp256k1 sig;
     public:
     Secp256k1VeriTask(const uint256_t &msg,
@@ -345,6 +351,28 @@ class Secp256k1VeriTask: public VeriTask {
     }
 };
 
+/** Verifies a batch of signatures on the same message in one task, used
+ * when a quorum certificate has more signatures than the workers. */
+class Secp256k1BatchVeriTask: public VeriTask {
+    uint256_t msg;
+    std::vector<std::pair<const PubKeySecp256k1 *, SigSecp256k1>> sigs;
+    public:
+    Secp256k1BatchVeriTask(const uint256_t &msg): msg(msg) {}
+    virtual ~Secp256k1BatchVeriTask() = default;
+
+    void add(const PubKeySecp256k1 &pubkey, const SigSecp256k1 &sig) {
+        sigs.emplace_back(&pubkey, sig);
+    }
+    size_t size() const { return sigs.size(); }
+
+    bool verify() override {
+        for (const auto &p: sigs)
+            if (!p.second.verify(msg, *p.first, secp256k1_default_verify_ctx))
+                return false;
+        return true;
+    }
+};
+
 class PartCertSecp256k1: public SigSecp256k1, public PartCert {
     uint256_t obj_hash;
 
@@ -425,6 +453,229 @@ class QuorumCertSecp256k1: public QuorumCert {
     }
 };
 
+class PrivKeyEd25519;
+
+/** Ed25519 public key (backed by OpenSSL). The parsed key is cached, so
+ * the verification does not pay for decoding the key each time. */
+class PubKeyEd25519: public PubKey {
+    static const auto nbytes = 32;
+    friend class SigEd25519;
+    uint8_t data[nbytes];
+    EVP_PKEY *pkey;
+
+    void load();
+
+    public:
+    PubKeyEd25519(): PubKey(), pkey(nullptr) {}
+    PubKeyEd25519(const bytearray_t &raw_bytes):
+        PubKeyEd25519() { from_bytes(raw_bytes); }
+    PubKeyEd25519(const PrivKeyEd25519 &priv_key);
+    PubKeyEd25519(const PubKeyEd25519 &other);
+    PubKeyEd25519 &operator=(const PubKeyEd25519 &other) = delete;
+    ~PubKeyEd25519() override { EVP_PKEY_free(pkey); }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed public key");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+        load();
+    }
+
+    PubKeyEd25519 *clone() override {
+        return new PubKeyEd25519(*this);
+    }
+};
+
+class PrivKeyEd25519: public PrivKey {
+    static const auto nbytes = 32;
+    friend class PubKeyEd25519;
+    friend class SigEd25519;
+    uint8_t data[nbytes];
+    EVP_PKEY *pkey;
+
+    void load();
+
+    public:
+    PrivKeyEd25519(): PrivKey(), pkey(nullptr) {}
+    PrivKeyEd25519(const bytearray_t &raw_bytes):
+        PrivKeyEd25519() { from_bytes(raw_bytes); }
+    PrivKeyEd25519(const PrivKeyEd25519 &) = delete;
+    ~PrivKeyEd25519() override { EVP_PKEY_free(pkey); }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed private key");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+        load();
+    }
+
+    void from_rand() override {
+        if (!RAND_bytes(data, nbytes))
+            throw std::runtime_error("cannot get rand bytes from openssl");
+        load();
+    }
+
+    pubkey_bt get_pubkey() const override {
+        return new PubKeyEd25519(*this);
+    }
+};
+
+class SigEd25519: public Serializable {
+    static const auto nbytes = 64;
+    uint8_t data[nbytes];
+
+    public:
+    SigEd25519(): Serializable() {}
+    SigEd25519(const uint256_t &digest, const PrivKeyEd25519 &priv_key):
+        Serializable() { sign(digest, priv_key); }
+
+    void serialize(DataStream &s) const override {
+        s.put_data(data, data + nbytes);
+    }
+
+    void unserialize(DataStream &s) override {
+        static const auto _exc = std::invalid_argument("ill-formed signature");
+        try {
+            memmove(data, s.get_data_inplace(nbytes), nbytes);
+        } catch (std::ios_base::failure &) {
+            throw _exc;
+        }
+    }
+
+    void sign(const bytearray_t &msg, const PrivKeyEd25519 &priv_key);
+    bool verify(const bytearray_t &msg, const PubKeyEd25519 &pub_key) const;
+};
+
+class Ed25519VeriTask: public VeriTask {
+    uint256_t msg;
+    const PubKeyEd25519 &pubkey;
+    SigEd25519 sig;
+    public:
+    Ed25519VeriTask(const uint256_t &msg,
+                    const PubKeyEd25519 &pubkey,
+                    const SigEd25519 &sig):
+        msg(msg), pubkey(pubkey), sig(sig) {}
+    virtual ~Ed25519VeriTask() = default;
+
+    bool verify() override {
+        return sig.verify(msg, pubkey);
+    }
+};
+
+/** Verifies a batch of signatures on the same message in one task, used
+ * when a quorum certificate has more signatures than the workers. */
+class Ed25519BatchVeriTask: public VeriTask {
+    uint256_t msg;
+    std::vector<std::pair<const PubKeyEd25519 *, SigEd25519>> sigs;
+    public:
+    Ed25519BatchVeriTask(const uint256_t &msg): msg(msg) {}
+    virtual ~Ed25519BatchVeriTask() = default;
+
+    void add(const PubKeyEd25519 &pubkey, const SigEd25519 &sig) {
+        sigs.emplace_back(&pubkey, sig);
+    }
+    size_t size() const { return sigs.size(); }
+
+    bool verify() override {
+        for (const auto &p: sigs)
+            if (!p.second.verify(msg, *p.first)) return false;
+        return true;
+    }
+};
+
+class PartCertEd25519: public SigEd25519, public PartCert {
+    uint256_t obj_hash;
+
+    public:
+    PartCertEd25519() = default;
+    PartCertEd25519(const PrivKeyEd25519 &priv_key, const uint256_t &obj_hash):
+        SigEd25519(obj_hash, priv_key),
+        PartCert(),
+        obj_hash(obj_hash) {}
+
+    bool verify(const PubKey &pub_key) override {
+        return SigEd25519::verify(obj_hash,
+                                static_cast<const PubKeyEd25519 &>(pub_key));
+    }
+
+    promise_t verify(const PubKey &pub_key, VeriPool &vpool) override {
+        return vpool.verify(new Ed25519VeriTask(obj_hash,
+                static_cast<const PubKeyEd25519 &>(pub_key),
+                static_cast<const SigEd25519 &>(*this)));
+    }
+
+    const uint256_t &get_obj_hash() const override { return obj_hash; }
+
+    PartCertEd25519 *clone() override {
+        return new PartCertEd25519(*this);
+    }
+
+    void serialize(DataStream &s) const override {
+        s << obj_hash;
+        this->SigEd25519::serialize(s);
+    }
+
+    void unserialize(DataStream &s) override {
+        s >> obj_hash;
+        this->SigEd25519::unserialize(s);
+    }
+};
+
+class QuorumCertEd25519: public QuorumCert {
+    uint256_t obj_hash;
+    salticidae::Bits rids;
+    std::unordered_map<ReplicaID, SigEd25519> sigs;
+
+    public:
+    QuorumCertEd25519() = default;
+    QuorumCertEd25519(const ReplicaConfig &config, const uint256_t &obj_hash);
+
+    void add_part(ReplicaID rid, const PartCert &pc) override {
+        if (pc.get_obj_hash() != obj_hash)
+            throw std::invalid_argument("PartCert does match the block hash");
+        sigs.insert(std::make_pair(
+            rid, static_cast<const PartCertEd25519 &>(pc)));
+        rids.set(rid);
+    }
+
+    void compute() override {}
+
+    bool verify(const ReplicaConfig &config) override;
+    promise_t verify(const ReplicaConfig &config, VeriPool &vpool) override;
+
+    const uint256_t &get_obj_hash() const override { return obj_hash; }
+
+    QuorumCertEd25519 *clone() override {
+        return new QuorumCertEd25519(*this);
+    }
+
+    void serialize(DataStream &s) const override {
+        s << obj_hash << rids;
+        for (size_t i = 0; i < rids.size(); i++)
+            if (rids.get(i)) s << sigs.at(i);
+    }
+
+    void unserialize(DataStream &s) override {
+        s >> obj_hash >> rids;
+        for (size_t i = 0; i < rids.size(); i++)
+            if (rids.get(i)) s >> sigs[i];
+    }
+};
+
 }
 
 #endif
@@ -23,12 +23,14 @@
 #include <string>
 #include <cstddef>
 #include <ios>
+#include <functional>
 
 #include "salticidae/netaddr.h"
 #include "salticidae/ref.h"
 #include "hotstuff/type.h"
 #include "hotstuff/util.h"
 #include "hotstuff/crypto.h"
+#include "hotstuff/merkle.h"
 
 namespace hotstuff {
 
@@ -98,6 +100,11 @@ class Command: public Serializable {
     virtual ~Command() = default;
     virtual const uint256_t &get_hash() const = 0;
     virtual bool verify() const = 0;
+    /** Get the client session of the command, if it has one.
+     * @return false if it does not belong to a session */
+    virtual bool get_session(uint32_t &/*cid*/, uint64_t &/*seq*/) const {
+        return false;
+    }
     virtual operator std::string () const {
         DataStream s;
         s << "<cmd id=" << get_hex10(get_hash()) << ">";
@@ -124,6 +131,11 @@ class Block {
     bytearray_t extra;
 
     /* the following fields can be derived from above */
+    /** Merkle root over cmds */
+    uint256_t cmd_root;
+    /** the number of commands (cmds stays empty until the body arrives for a
+     * block received by its header) */
+    uint32_t ncmds;
     uint256_t hash;
     std::vector<block_t> parents;
     block_t qc_ref;
@@ -137,13 +149,15 @@ class Block {
     public:
     Block():
         qc(nullptr),
+        ncmds(0),
         qc_ref(nullptr),
         self_qc(nullptr), height(0),
         delivered(false), decision(0) {}
 
     Block(bool delivered, int8_t decision):
         qc(nullptr),
-        hash(salticidae::get_hash(*this)),
+        ncmds(0),
+        hash(get_header_hash()),
         qc_ref(nullptr),
         self_qc(nullptr), height(0),
         delivered(delivered), decision(decision) {}
@@ -160,7 +174,9 @@ class Block {
             cmds(cmds),
             qc(std::move(qc)),
             extra(std::move(extra)),
-            hash(salticidae::get_hash(*this)),
+            cmd_root(merkle_root(cmds)),
+            ncmds(cmds.size()),
+            hash(get_header_hash()),
             parents(parents),
             qc_ref(qc_ref),
             self_qc(std::move(self_qc)),
@@ -172,10 +188,36 @@ class Block {
 
     void unserialize(DataStream &s, HotStuffCore *hsc);
 
+    /** Write the header, which is what the block hash covers: the commands
+     * are only included by their Merkle root, so the header size does not
+     * grow with the block. */
+    void serialize_header(DataStream &s) const;
+
+    /** Read a header written by `serialize_header`, leaving the body (the
+     * commands) to be filled in by `set_body`. */
+    void unserialize_header(DataStream &s, HotStuffCore *hsc);
+
+    /** Fill in the commands of a block received by its header.
+     * @return false if they do not match the header */
+    bool set_body(std::vector<uint256_t> &&cmds);
+
+    bool has_body() const { return cmds.size() == ncmds; }
+
+    uint256_t get_header_hash() const {
+        DataStream s;
+        serialize_header(s);
+        return s.get_hash();
+    }
+
     const std::vector<uint256_t> &get_cmds() const {
         return cmds;
     }
 
+    const uint256_t &get_cmd_root() const { return cmd_root; }
+
+    /** Get the Merkle tree over the commands, to prove their inclusion. */
+    MerkleTree get_cmd_tree() const { return MerkleTree(cmds); }
+
     const std::vector<block_t> &get_parents() const {
         return parents;
     }
@@ -220,9 +262,28 @@ struct BlockHeightCmp {
 };
 
 class EntityStorage {
+    public:
+    using body_cb_t = std::function<void(const block_t &)>;
+
+    private:
     std::unordered_map<const uint256_t, block_t> blk_cache;
     std::unordered_map<const uint256_t, command_t> cmd_cache;
+    body_cb_t body_cb;
+
     public:
+    /** Set the callback invoked whenever the body of a block known by its
+     * header is filled in, however it arrives. */
+    void set_body_cb(body_cb_t cb) { body_cb = std::move(cb); }
+
+    /** Fill in the body of a block received by its header.
+     * @return false if the commands do not match the header */
+    bool add_body(const block_t &blk, std::vector<uint256_t> &&cmds) {
+        if (blk->has_body()) return true;
+        if (!blk->set_body(std::move(cmds))) return false;
+        if (body_cb) body_cb(blk);
+        return true;
+    }
+
     bool is_blk_delivered(const uint256_t &blk_hash) {
         auto it = blk_cache.find(blk_hash);
         if (it == blk_cache.end()) return false;
@@ -239,6 +300,17 @@ class EntityStorage {
         //    HOTSTUFF_LOG_WARN("invalid %s", std::string(_blk).c_str());
         //    return nullptr;
         //}
+        auto it = blk_cache.find(_blk.get_hash());
+        if (it != blk_cache.end())
+        {
+            /* complete a block only known by its header (the commands are
+             * covered by the hash) */
+            if (!it->second->has_body() && _blk.has_body() &&
+                !add_body(it->second, std::vector<uint256_t>(_blk.get_cmds())))
+                HOTSTUFF_LOG_WARN("mismatching body of %s",
+                                std::string(*it->second).c_str());
+            return it->second;
+        }
         block_t blk = new Block(std::move(_blk));
         return blk_cache.insert(std::make_pair(blk->get_hash(), blk)).first->second;
     }
@@ -265,10 +337,10 @@ class EntityStorage {
         return it == cmd_cache.end() ? nullptr: it->second;
     }
 
-    size_t get_cmd_cache_size() {
+    size_t get_cmd_cache_size() const {
         return cmd_cache.size();
     }
-    size_t get_blk_cache_size() {
+    size_t get_blk_cache_size() const {
         return blk_cache.size();
     }
 
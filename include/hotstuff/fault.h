@@ -0,0 +1,124 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_FAULT_H
+#define _HOTSTUFF_FAULT_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** Deterministic fault injection for the outgoing replica messages.
+ *
+ * The faults follow a schedule of rules, each active in a time window
+ * (in seconds since `start()`). A rule applies to the messages sent to a
+ * given replica (or any), of a given opcode (or any):
+ *
+ *     # start end  action    dest opcode prob [param]
+ *     10      20   drop      1    *      0.5
+ *     10      20   delay     *    0x0    1     0.2
+ *     5       15   duplicate *    *      0.1
+ *     5       15   reorder   *    *      1     0.05
+ *     30      40   partition 0,1
+ *
+ * `delay` holds a message for `param` seconds, `reorder` for a random time
+ * up to `param` seconds (so that the later messages overtake it) and
+ * `partition` drops all messages crossing the boundary of the given group
+ * of replicas (a group of one replica emulates its crash). As all replicas
+ * load the same schedule and the random choices come from a seeded
+ * generator, a run is reproducible up to the order of the messages. */
+class FaultInjector {
+    public:
+    enum Action {
+        DROP,
+        DELAY,
+        DUPLICATE,
+        REORDER,
+        PARTITION
+    };
+
+    struct Rule {
+        double start;
+        double end;
+        Action action;
+        /** destination replica (-1 for any) */
+        int32_t dest;
+        /** message opcode (-1 for any) */
+        int32_t opcode;
+        double prob;
+        double param;
+        std::unordered_set<ReplicaID> group;
+    };
+
+    struct Verdict {
+        /** number of copies to be sent (0 for a drop) */
+        uint32_t ncopies;
+        /** time to hold the message */
+        double delay;
+        Verdict(): ncopies(1), delay(0) {}
+    };
+
+    using callback_t = std::function<void()>;
+
+    FaultInjector(const EventContext &ec, ReplicaID rid, uint64_t seed);
+
+    /** Load the rules from a schedule file (see above). */
+    void load(const std::string &fname);
+    void add_rule(const Rule &rule) { rules.push_back(rule); }
+    /** Start the clock of the schedule. */
+    void start();
+
+    /** Decide what to do with a message of `opcode` sent to `dest`. */
+    Verdict judge(ReplicaID dest, opcode_t opcode);
+    /** Invoke `cb` after `delay` seconds. */
+    void defer(double delay, callback_t cb);
+
+    uint64_t get_ndropped() const { return ndropped; }
+    uint64_t get_ndelayed() const { return ndelayed; }
+    uint64_t get_nduplicated() const { return nduplicated; }
+
+    private:
+    using clock_t = std::chrono::steady_clock;
+    const ReplicaID rid;
+    std::mt19937_64 rng;
+    std::uniform_real_distribution<double> dist;
+    std::vector<Rule> rules;
+    clock_t::time_point start_time;
+    /* the deferred messages ordered by their due time */
+    std::multimap<double, callback_t> deferred;
+    TimerEvent deferred_timer;
+    /* statistics */
+    uint64_t ndropped;
+    uint64_t ndelayed;
+    uint64_t nduplicated;
+
+    double now() const;
+    void on_deferred();
+};
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_FEED_H
+#define _HOTSTUFF_FEED_H
+
+#include <deque>
+#include <thread>
+#include <unordered_map>
+
+#include "salticidae/event.h"
+#include "salticidae/network.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** A committed block as seen by the feed consumers. The i-th command is
+ * committed with the finality (decision = 1, cmd_idx = i, cmd_height =
+ * height, blk_hash). */
+struct CommitRecord: public Serializable {
+    uint32_t height;
+    uint256_t blk_hash;
+    std::vector<uint256_t> cmds;
+
+    CommitRecord(): height(0) {}
+    CommitRecord(uint32_t height, const uint256_t &blk_hash,
+                const std::vector<uint256_t> &cmds):
+        height(height), blk_hash(blk_hash), cmds(cmds) {}
+
+    void serialize(DataStream &s) const override {
+        s << htole(height) << blk_hash << htole((uint32_t)cmds.size());
+        for (const auto &cmd: cmds) s << cmd;
+    }
+
+    void unserialize(DataStream &s) override {
+        uint32_t n;
+        s >> height >> blk_hash >> n;
+        height = letoh(height);
+        cmds.resize(letoh(n));
+        for (auto &cmd: cmds) s >> cmd;
+    }
+};
+
+/** Subscribe to the records above height `cursor`, allowing at most
+ * `window` of them to be unacknowledged. Sending it again restarts the
+ * stream from the new cursor. */
+struct MsgFeedSub {
+    static const opcode_t opcode = 0x0;
+    DataStream serialized;
+    uint32_t cursor;
+    uint32_t window;
+    MsgFeedSub(uint32_t cursor, uint32_t window) {
+        serialized << htole(cursor) << htole(window);
+    }
+    MsgFeedSub(DataStream &&s) {
+        s >> cursor >> window;
+        cursor = letoh(cursor);
+        window = letoh(window);
+    }
+};
+
+/** Acknowledge the records up to `height` (inclusive), so that more of them
+ * can be sent. */
+struct MsgFeedAck {
+    static const opcode_t opcode = 0x1;
+    DataStream serialized;
+    uint32_t height;
+    MsgFeedAck(uint32_t height) { serialized << htole(height); }
+    MsgFeedAck(DataStream &&s) {
+        s >> height;
+        height = letoh(height);
+    }
+};
+
+/** A batch of consecutive records. */
+struct MsgFeedRecords {
+    static const opcode_t opcode = 0x2;
+    DataStream serialized;
+    std::vector<CommitRecord> records;
+    template<typename It>
+    MsgFeedRecords(It begin, It end) {
+        serialized << htole((uint32_t)(end - begin));
+        for (auto it = begin; it != end; it++) serialized << *it;
+    }
+    MsgFeedRecords(DataStream &&s) {
+        uint32_t n;
+        s >> n;
+        records.resize(letoh(n));
+        for (auto &rec: records) s >> rec;
+    }
+};
+
+/** The records right above the cursor are no longer kept: the consumer
+ * should catch up by other means (e.g., the block log) and resubscribe from
+ * `height - 1` at the earliest. */
+struct MsgFeedGone {
+    static const opcode_t opcode = 0x3;
+    DataStream serialized;
+    uint32_t height;
+    MsgFeedGone(uint32_t height) { serialized << htole(height); }
+    MsgFeedGone(DataStream &&s) {
+        s >> height;
+        height = letoh(height);
+    }
+};
+
+/** Streams the committed blocks, in order, to the consumers connected to a
+ * local socket. The recent records are kept in memory, and each consumer
+ * resumes from its own cursor at its own pace (bounded by its window). The
+ * service runs on a dedicated thread, so the consensus thread only enqueues
+ * the records. */
+class CommitFeed {
+    public:
+    using Net = salticidae::MsgNetwork<opcode_t>;
+
+    private:
+    using queue_t = salticidae::MPSCQueueEventDriven<CommitRecord>;
+    struct Subscriber {
+        /** the height of the next record to send */
+        uint32_t next;
+        /** the height of the last acknowledged record */
+        uint32_t acked;
+        uint32_t window;
+    };
+    EventContext ec;
+    queue_t queue;
+    Net net;
+    /** the consecutive records kept in memory */
+    std::deque<CommitRecord> records;
+    size_t max_records;
+    size_t max_batch;
+    std::unordered_map<Net::conn_t, Subscriber> subs;
+    BoxObj<salticidae::ThreadCall> tcall;
+    std::thread handle;
+
+    void sub_handler(MsgFeedSub &&, const Net::conn_t &);
+    void ack_handler(MsgFeedAck &&, const Net::conn_t &);
+    /** Send the records a subscriber is ready for.
+     * @return false if the subscriber is behind the kept records (and has
+     * been told so) */
+    bool pump(const Net::conn_t &conn, Subscriber &sub);
+
+    public:
+    /** Listen to consumers at `listen_addr`, keeping the last `max_records`
+     * records and sending at most `max_batch` of them in one message. */
+    CommitFeed(const NetAddr &listen_addr,
+                size_t max_records = 65536,
+                size_t max_batch = 64,
+                const Net::Config &config = Net::Config());
+    CommitFeed(const CommitFeed &) = delete;
+    ~CommitFeed();
+
+    /** Enqueue the next committed block, could be called from any thread. */
+    void append(CommitRecord &&rec) { queue.enqueue(std::move(rec)); }
+};
+
+}
+
+#endif
@@ -18,7 +18,10 @@
 #ifndef _HOTSTUFF_CORE_H
 #define _HOTSTUFF_CORE_H
 
+#include <map>
 #include <queue>
+#include <deque>
+#include <chrono>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -27,6 +30,12 @@
 #include "salticidae/msg.h"
 #include "hotstuff/util.h"
 #include "hotstuff/consensus.h"
+#include "hotstuff/blocklog.h"
+#include "hotstuff/fault.h"
+#include "hotstuff/compress.h"
+#include "hotstuff/feed.h"
+#include "hotstuff/bloom.h"
+#include "hotstuff/timer.h"
 
 namespace hotstuff {
 
@@ -36,7 +45,12 @@ using salticidae::_1;
 using salticidae::_2;
 
 const double ent_waiting_timeout = 10;
+const double blk_delivery_stale_timeout = 10 * ent_waiting_timeout;
+/** a fetch for delivery taking longer than this gives up its slot */
+const double delivery_slot_timeout = 2 * ent_waiting_timeout;
 const double double_inf = 1e10;
+/** the most heights served in one segment of the swarm sync */
+const uint32_t sync_segment_limit = 4096;
 
 /** Network message format for HotStuff. */
 struct MsgPropose {
@@ -78,6 +92,137 @@ struct MsgRespBlock {
     void postponed_parse(HotStuffCore *hsc);
 };
 
+struct MsgCheckpoint {
+    static const opcode_t opcode = 0x6;
+    DataStream serialized;
+    CheckpointVote vote;
+    MsgCheckpoint(const CheckpointVote &);
+    MsgCheckpoint(DataStream &&s): serialized(std::move(s)) {}
+    void postponed_parse(HotStuffCore *hsc);
+};
+
+/** Messages for the same peer coalesced into one frame. */
+struct MsgBatch {
+    static const opcode_t opcode = 0x7;
+    DataStream serialized;
+    std::vector<std::pair<opcode_t, DataStream>> msgs;
+    MsgBatch(uint32_t nmsgs, const DataStream &payload);
+    MsgBatch(DataStream &&s);
+};
+
+/** A compressed message. */
+struct MsgCompressed {
+    static const opcode_t opcode = 0x8;
+    DataStream serialized;
+    opcode_t inner_opcode;
+    uint32_t raw_size;
+    bytearray_t data;
+    MsgCompressed(opcode_t inner_opcode, uint32_t raw_size, const bytearray_t &data);
+    MsgCompressed(DataStream &&s);
+};
+
+/** What a replica can decompress: whether it is built with the compression,
+ * and the hash of its dictionary (zero if none). The receiver replies with
+ * its own if `ask` is set. A replica only compresses the messages to a peer
+ * whose capabilities match its own compression. */
+struct MsgCompressCaps {
+    static const opcode_t opcode = 0x16;
+    DataStream serialized;
+    bool supported;
+    bool ask;
+    uint256_t dict_hash;
+    MsgCompressCaps(bool supported, bool ask, const uint256_t &dict_hash);
+    MsgCompressCaps(DataStream &&s);
+};
+
+/** Ask a replica for the height it last voted for (to learn a read index). */
+struct MsgReadIndexReq {
+    static const opcode_t opcode = 0x9;
+    DataStream serialized;
+    uint64_t nonce;
+    MsgReadIndexReq(uint64_t nonce);
+    MsgReadIndexReq(DataStream &&s);
+};
+
+struct MsgReadIndexResp {
+    static const opcode_t opcode = 0xa;
+    DataStream serialized;
+    uint64_t nonce;
+    uint32_t vheight;
+    MsgReadIndexResp(uint64_t nonce, uint32_t vheight);
+    MsgReadIndexResp(DataStream &&s);
+};
+
+/** Subscribe a learner to the committed blocks above `height`. */
+struct MsgLearn {
+    static const opcode_t opcode = 0xd;
+    DataStream serialized;
+    uint32_t height;
+    MsgLearn(uint32_t height);
+    MsgLearn(DataStream &&s);
+};
+
+/** Committed blocks for a learner, followed by the blocks committing the
+ * last of them and a QC for the last block. */
+struct MsgCommitted {
+    static const opcode_t opcode = 0xe;
+    DataStream serialized;
+    std::vector<block_t> blks;
+    quorum_cert_bt qc;
+    MsgCommitted(const std::vector<block_t> &blks, const QuorumCert &qc);
+    MsgCommitted(DataStream &&s): serialized(std::move(s)) {}
+    void postponed_parse(HotStuffCore *hsc);
+};
+
+/** Ask for the committed blocks with heights in [from, to] (a segment), or
+ * for the last executed block with its commit proof (the tip) if `to` is 0. */
+struct MsgReqSegment {
+    static const opcode_t opcode = 0x14;
+    DataStream serialized;
+    uint32_t from;
+    uint32_t to;
+    MsgReqSegment(uint32_t from, uint32_t to);
+    MsgReqSegment(DataStream &&s);
+};
+
+/** The committed blocks of a segment in height order. For the tip, `from`
+ * is the height of the tip, which is followed by the blocks committing it
+ * and a QC for the last of them (as in MsgCommitted). */
+struct MsgRespSegment {
+    static const opcode_t opcode = 0x15;
+    DataStream serialized;
+    uint32_t from;
+    uint32_t to;
+    std::vector<block_t> blks;
+    quorum_cert_bt qc;
+    MsgRespSegment(uint32_t from, uint32_t to,
+                    const std::vector<block_t> &blks,
+                    const QuorumCert *qc = nullptr);
+    MsgRespSegment(DataStream &&s): serialized(std::move(s)) {}
+    void postponed_parse(HotStuffCore *hsc);
+};
+
+/** A proposal carrying only the header of the block, which is enough to run
+ * the safety rule; the body follows in MsgBlockBody. */
+struct MsgProposeHeader {
+    static const opcode_t opcode = 0x10;
+    DataStream serialized;
+    Proposal proposal;
+    MsgProposeHeader(const Proposal &);
+    MsgProposeHeader(DataStream &&s): serialized(std::move(s)) {}
+    void postponed_parse(HotStuffCore *hsc);
+};
+
+/** The commands of a block sent by its header. */
+struct MsgBlockBody {
+    static const opcode_t opcode = 0x11;
+    DataStream serialized;
+    uint256_t blk_hash;
+    std::vector<uint256_t> cmds;
+    MsgBlockBody(const Block &blk);
+    MsgBlockBody(DataStream &&s);
+};
+
 using promise::promise_t;
 
 class HotStuffBase;
@@ -85,12 +230,13 @@ using pacemaker_bt = BoxObj<class PaceMaker>;
 
 template<EntityType ent_type>
 class FetchContext: public promise_t {
-    TimerEvent timeout;
+    /* on the timer wheel, as thousands could be live during a catch-up */
+    WheelTimer timeout;
     HotStuffBase *hs;
     MsgReqBlock fetch_msg;
     const uint256_t ent_hash;
     std::unordered_set<NetAddr> replica_ids;
-    inline void timeout_cb(TimerEvent &);
+    inline void timeout_cb(WheelTimer &);
     public:
     FetchContext(const FetchContext &) = delete;
     FetchContext &operator=(const FetchContext &) = delete;
@@ -142,6 +288,8 @@ class HotStuffBase: public HotStuffCore {
     EventContext ec;
     salticidae::ThreadCall tcall;
     VeriPool vpool;
+    /** signs the votes off the event loop (disabled if null) */
+    BoxObj<SignPool> spool;
     std::vector<NetAddr> peers;
 
     private:
@@ -157,16 +305,196 @@ class HotStuffBase: public HotStuffCore {
     /* queues for async tasks */
     std::unordered_map<const uint256_t, BlockFetchContext> blk_fetch_waiting;
     std::unordered_map<const uint256_t, BlockDeliveryContext> blk_delivery_waiting;
-    std::unordered_map<const uint256_t, commit_cb_t> decision_waiting;
-    using cmd_queue_t = salticidae::MPSCQueueEventDriven<std::pair<uint256_t, commit_cb_t>>;
+    /** a fetched block waiting for the delivery of its parents */
+    struct DeliveryNode {
+        block_t blk;
+        /** the parents and checks it still waits for */
+        size_t nmissing;
+    };
+    std::unordered_map<const uint256_t, DeliveryNode> delivery_pending;
+    /** the waiting blocks depending on each undelivered block */
+    std::unordered_map<const uint256_t, std::vector<uint256_t>> delivery_dependents;
+    /** the blocks to fetch for delivery, with the replica to ask */
+    std::deque<std::pair<uint256_t, NetAddr>> delivery_fetch_queue;
+    /** the blocks to deliver which are already fetched, taking no slot */
+    std::deque<std::pair<uint256_t, NetAddr>> delivery_local_queue;
+    /** the blocks being fetched for delivery, with the time they took a slot */
+    std::unordered_map<const uint256_t, std::chrono::steady_clock::time_point> delivery_fetching;
+    /** the fetches for delivery which gave up their slots, still awaited */
+    std::unordered_set<uint256_t> delivery_fetch_slow;
+    size_t max_delivery_fetch;
+    bool delivery_pumping;
+    /** frees the slots of slow fetches and drops the stale deliveries */
+    WheelTimer delivery_timer;
+    /** the blocks received by their headers, waiting for the bodies */
+    std::unordered_map<const uint256_t, BlockFetchContext> body_fetch_waiting;
+    /** a submitted command, optionally within a client session */
+    struct CmdRequest {
+        uint256_t cmd_hash;
+        commit_cb_t callback;
+        bool session;
+        uint32_t cid;
+        uint64_t seq;
+        CmdRequest(): session(false), cid(0), seq(0) {}
+        CmdRequest(const uint256_t &cmd_hash, commit_cb_t &&callback,
+                bool session = false, uint32_t cid = 0, uint64_t seq = 0):
+            cmd_hash(cmd_hash), callback(std::move(callback)),
+            session(session), cid(cid), seq(seq) {}
+    };
+    std::unordered_map<const uint256_t, CmdRequest> decision_waiting;
+    /** the last executed command of a client, with the cached reply */
+    struct ClientSession {
+        uint64_t seq;
+        Finality fin;
+    };
+    /** the client sessions, keyed by the client id */
+    std::unordered_map<uint32_t, ClientSession> sessions;
+    /** whether the callbacks for a committed block are being invoked */
+    bool deciding;
+    using cmd_queue_t = salticidae::MPSCQueueEventDriven<CmdRequest>;
     cmd_queue_t cmd_pending;
     std::queue<uint256_t> cmd_pending_buffer;
+    /** the recently committed commands, to reject the replays (disabled if
+     * null) */
+    BoxObj<RotatingBloomFilter> committed_filter;
+    /** timer to run the incremental pruning across event loop iterations */
+    TimerEvent prune_timer;
+    /** time budget (in seconds) for each pruning tick */
+    double prune_budget;
+    bool prune_scheduled;
+    /** digest chained over the executed blocks (only kept with the
+     * checkpoints or the reads enabled) */
+    uint256_t exec_digest;
+    /** on-disk log of the committed blocks */
+    BoxObj<BlockLogWriter> blk_log;
+    /** streams the committed blocks to local consumers (disabled if null) */
+    BoxObj<CommitFeed> commit_feed;
+    /** file of the warm-start snapshot (disabled if empty) */
+    std::string snapshot_path;
+    /** interval (in seconds) of writing the snapshot (0 for no periodic write) */
+    double snapshot_period;
+    TimerEvent snapshot_timer;
+    /** file recording the vote state next to the snapshot (-1 if none) */
+    int vote_fd;
+    /** injects faults into the outgoing messages (for testing) */
+    BoxObj<FaultInjector> faults;
+    std::unordered_map<const NetAddr, ReplicaID> peer_rid;
+    /** the outgoing messages being coalesced for a peer */
+    struct BatchBuffer {
+        DataStream payload;
+        uint32_t nmsgs;
+        BatchBuffer(): nmsgs(0) {}
+    };
+    std::unordered_map<const NetAddr, BatchBuffer> batch_buffers;
+    /** the maximum delay (in seconds) of a batched message (0 to disable) */
+    double batch_delay;
+    /** flush a batch once it exceeds this size (in bytes) */
+    size_t batch_max_bytes;
+    TimerEvent batch_timer;
+    bool batch_scheduled;
+    /** compresses the block messages (disabled if null) */
+    BoxObj<Compressor> compressor;
+    /** only compress the messages not smaller than this (in bytes) */
+    size_t compress_threshold;
+    /** CPU time (in seconds per second) allowed to be spent on compression */
+    double compress_budget;
+    double compress_credit;
+    std::chrono::steady_clock::time_point compress_last;
+    /** whether a peer can decompress the messages from this replica, as
+     * learned from its MsgCompressCaps (which it also sends upon failing
+     * to decompress a message) */
+    struct PeerCompressCaps {
+        bool known;
+        bool compatible;
+        std::chrono::steady_clock::time_point asked;
+        PeerCompressCaps(): known(false), compatible(false) {}
+    };
+    std::unordered_map<const NetAddr, PeerCompressCaps> peer_compress_caps;
+    /* linearizable reads */
+    struct PendingRead {
+        promise_t pm;
+        std::chrono::steady_clock::time_point deadline;
+    };
+    /** the reads to be confirmed by the next round */
+    std::vector<PendingRead> read_queued;
+    /** the reads being confirmed by the ongoing round */
+    std::vector<PendingRead> read_confirming;
+    /** the confirmed reads, keyed by the height the execution should reach */
+    std::multimap<uint32_t, PendingRead> read_waiting;
+    uint64_t read_nonce;
+    std::unordered_set<ReplicaID> read_acks;
+    /** the highest voted height reported in the ongoing round */
+    uint32_t read_vheight;
+    /** serve the reads (and keep the digest returned with them) */
+    bool read_index_enabled;
+    /** the time (in seconds) a read may wait before it fails */
+    double read_timeout;
+    TimerEvent read_timer;
+    bool read_timer_scheduled;
+    TimerEvent read_exec_timer;
+    /* learners */
+    /** the learners fed by this replica (set before `start()`) */
+    std::vector<std::pair<NetAddr, uint256_t>> learners;
+    /** the height of the last block sent to each subscribed learner */
+    std::unordered_map<const NetAddr, uint32_t> learner_height;
+    TimerEvent learner_timer;
+    bool learner_scheduled;
+    /** the replicas (by index) feeding this learner (empty if not a learner) */
+    std::vector<ReplicaID> learn_sources;
+    std::vector<NetAddr> learn_source_addrs;
+    /** interval (in seconds) of (re-)subscribing to the sources */
+    double learn_period;
+    TimerEvent learn_timer;
+    /* swarm sync */
+    /** a range of committed heights requested from one replica */
+    struct SyncSegment {
+        uint32_t from;
+        /** the replica asked (by the index in the sync peers) */
+        size_t peer;
+        size_t ntries;
+        std::chrono::steady_clock::time_point sent;
+        /** the received blocks (empty until then) */
+        std::vector<block_t> blks;
+        SyncSegment(): from(0), peer(0), ntries(0) {}
+    };
+    /** the number of heights per segment (0 disables the swarm sync) */
+    uint32_t sync_segment_size;
+    double sync_timeout;
+    bool syncing;
+    /** bumped by each sync, to tell the stale callbacks */
+    uint32_t sync_round;
+    /** the executed block the sync extends, and the height above it */
+    uint256_t sync_base;
+    uint32_t sync_from;
+    /** the verified tip (followed by the blocks committing it), its height,
+     * and the replica it came from */
+    std::vector<block_t> sync_tip;
+    uint32_t sync_to;
+    NetAddr sync_tip_peer;
+    /** the requested segments not yet stitched, by their last heights (0
+     * for the tip) */
+    std::map<uint32_t, SyncSegment> sync_segments;
+    /** the segments are requested and stitched downwards from the tip: the
+     * last height of the next segment to request, the lowest stitched
+     * height, and the hash the segment below it should end with */
+    uint32_t sync_next_req;
+    uint32_t sync_low;
+    uint256_t sync_need;
+    size_t sync_rr;
+    WheelTimer sync_timer;
+    /** propose the headers and send the bodies separately */
+    bool header_first;
 
     /* statistics */
     uint64_t fetched;
     uint64_t delivered;
     mutable uint64_t nsent;
     mutable uint64_t nrecv;
+    mutable uint64_t nsentb;
+    mutable uint64_t nrecvb;
+    uint64_t ncompressed;
+    uint64_t compress_saved;
+    uint64_t nsynced;
 
     mutable uint32_t part_parent_size;
     mutable uint32_t part_fetched;
@@ -181,28 +509,153 @@ class HotStuffBase: public HotStuffCore {
     void on_fetch_cmd(const command_t &cmd);
     void on_fetch_blk(const block_t &blk);
     void on_deliver_blk(const block_t &blk);
+    void on_fetch_body(const block_t &blk);
+    /** Returns a promise resolved (with the block) once the body of a block
+     * is available. It is expected from the proposer and fetched from any
+     * replica if it does not arrive in time. */
+    promise_t async_fetch_body(const block_t &blk);
+    /** send a message to a replica, subject to the injected faults */
+    template<typename MsgType>
+    void send_msg(MsgType &&msg, const NetAddr &addr);
+    /** send a message to all other replicas */
+    template<typename MsgType>
+    void multicast_msg(MsgType &&msg);
+    /** hand a message over to the network, or to the batch of the peer */
+    template<typename MsgType>
+    void transmit_msg(MsgType &&msg, const NetAddr &addr);
+    void batch_msg(opcode_t opcode, const DataStream &msg, const NetAddr &addr);
+    void flush_batch(const NetAddr &addr, BatchBuffer &buff);
+    /** compress a message if it is worthwhile and within the CPU budget
+     * (returns null otherwise) */
+    BoxObj<MsgCompressed> compress_msg(opcode_t opcode, const DataStream &msg);
+    bool compress_enabled() const { return compressor && compress_budget > 0; }
+    /** whether the messages to a peer may be compressed, asking the peer
+     * for its capabilities if they are not known yet */
+    bool compress_to(const NetAddr &addr);
+    /** tell a peer what this replica can decompress */
+    void send_compress_caps(const NetAddr &addr, bool ask);
+    /** pass an unwrapped message to its handler */
+    void dispatch_msg(opcode_t opcode, DataStream &&msg, const Net::conn_t &conn);
+    /** send the newly committed blocks to a subscribed learner */
+    void feed_learner(const NetAddr &addr, uint32_t &height);
+    void start_read_round();
+    void finish_read_round();
+    /** resolve the reads whose indices have been executed */
+    void apply_reads();
+    /** fail the reads that have been waiting for too long */
+    void expire_reads();
+    /** restore the consensus state from the snapshot file, if any */
+    void load_snapshot();
+    /** restore the vote state recorded since the snapshot, if any, and
+     * keep its file open for recording the later votes */
+    void load_vote_state();
+    /** drop the block deliveries that have been waiting for too long */
+    void drain_stale_delivery();
+    /** start delivering a block, unless it is being delivered */
+    void start_delivery(const uint256_t &blk_hash, const NetAddr &replica_id);
+    /** deliver the queued blocks already fetched, and fetch the others up to
+     * the limit */
+    void pump_delivery_fetch();
+    void on_delivery_fetched(const block_t &blk, const NetAddr &replica_id);
+    /** one thing a fetched block waits for is done */
+    void on_delivery_dep(const uint256_t &blk_hash);
+    /** deliver a block and then those it unblocks, lower heights first */
+    void deliver_ready(const block_t &blk);
+    /** the replicas to sync from (the sources for a learner) */
+    const std::vector<NetAddr> &get_sync_peers() const {
+        return is_learner() ? learn_source_addrs : peers;
+    }
+    /** start a swarm sync above the executed block, unless one is running */
+    void start_sync();
+    void finish_sync();
+    /** (re-)send the request of a segment (or the tip, keyed by 0) to the
+     * next replica
+     * @return false if it has been tried too many times */
+    bool request_segment(uint32_t to, SyncSegment &seg);
+    /** request the segments below the tip, a few per replica at a time */
+    void pump_sync();
+    /** stitch the received segments downwards from the tip, and deliver and
+     * execute the whole range once it links to the executed block */
+    void stitch_segments();
 
     /** deliver consensus message: <propose> */
     inline void propose_handler(MsgPropose &&, const Net::conn_t &);
+    /** deliver consensus message: <propose> with the block header only */
+    inline void propose_header_handler(MsgProposeHeader &&, const Net::conn_t &);
+    /** receives the body of a proposed block */
+    inline void blk_body_handler(MsgBlockBody &&, const Net::conn_t &);
     /** deliver consensus message: <vote> */
     inline void vote_handler(MsgVote &&, const Net::conn_t &);
     /** fetches full block data */
     inline void req_blk_handler(MsgReqBlock &&, const Net::conn_t &);
     /** receives a block */
     inline void resp_blk_handler(MsgRespBlock &&, const Net::conn_t &);
+    /** deliver a checkpoint vote */
+    inline void ckpt_handler(MsgCheckpoint &&, const Net::conn_t &);
+    /** split a batch back into messages */
+    inline void batch_handler(MsgBatch &&, const Net::conn_t &);
+    /** decompress a message */
+    inline void compressed_handler(MsgCompressed &&, const Net::conn_t &);
+    /** learn (and answer) what a peer can decompress */
+    inline void compress_caps_handler(MsgCompressCaps &&, const Net::conn_t &);
+    /** reply with the voted height */
+    inline void read_index_req_handler(MsgReadIndexReq &&, const Net::conn_t &);
+    /** collect a voted height for the ongoing read round */
+    inline void read_index_resp_handler(MsgReadIndexResp &&, const Net::conn_t &);
+    /** (re-)subscribe a learner */
+    inline void learn_handler(MsgLearn &&, const Net::conn_t &);
+    /** verify and execute the committed blocks (for a learner) */
+    inline void committed_handler(MsgCommitted &&, const Net::conn_t &);
+    /** serve a segment of the committed blocks (or the tip) */
+    inline void req_segment_handler(MsgReqSegment &&, const Net::conn_t &);
+    /** receive a segment (or the tip) for the swarm sync */
+    inline void resp_segment_handler(MsgRespSegment &&, const Net::conn_t &);
 
     inline bool conn_handler(const salticidae::ConnPool::conn_t &, bool);
 
     void do_broadcast_proposal(const Proposal &) override;
     void do_vote(ReplicaID, const Vote &) override;
-    void do_decide(Finality &&) override;
+    void do_decide(const BlockFinality &) override;
     void do_consensus(const block_t &blk) override;
+    void do_prune() override;
+    uint256_t do_state_digest() override { return state_machine_digest(); }
+    void do_save_snapshot(DataStream &s) const override { s << exec_digest; }
+    void do_load_snapshot(DataStream &s) override { s >> exec_digest; }
+    bool do_persist_vote(uint32_t vheight, const block_t &lock) override;
+    void do_broadcast_checkpoint(const CheckpointVote &) override;
+    void do_checkpoint(const Checkpoint &, const QuorumCert &) override;
+    promise_t async_create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) override;
 
     protected:
 
     /** Called to replicate the execution of a command, the application should
-     * implement this to make transition for the application state. */
-    virtual void state_machine_execute(const Finality &) = 0;
+     * implement this (or `state_machine_execute_blk`) to make transition for
+     * the application state. */
+    virtual void state_machine_execute(const Finality &) {}
+    /** Called to replicate the execution of all commands in a committed
+     * block at once. By default, it calls `state_machine_execute` for each
+     * command. */
+    virtual void state_machine_execute_blk(const BlockFinality &bfin) {
+        for (size_t i = 0; i < bfin.size(); i++)
+            state_machine_execute(bfin.get(i));
+    }
+    /** Called once the callbacks (see `exec_command`) of the commands in a
+     * committed block have all been invoked, e.g., to flush the responses
+     * batched by them. */
+    virtual void state_machine_decided_blk(const BlockFinality &) {}
+    /** Whether the callbacks (see `exec_command`) are being invoked for a
+     * committed block, to be followed by `state_machine_decided_blk()`. A
+     * callback could also be invoked outside of it, e.g., with the cached
+     * reply to a retried command. */
+    bool is_deciding() const { return deciding; }
+    /** Called to get the digest of the application state at a checkpoint
+     * (or for a read). By default, it is a hash chain over the commands of
+     * the executed blocks, only kept if the checkpoints or the reads (see
+     * `set_read_index()`) are enabled. */
+    virtual uint256_t state_machine_digest() { return exec_digest; }
+    /** Called when a checkpoint is certified by a quorum. The application
+     * could persist the certificate and discard older state. */
+    virtual void state_machine_checkpoint(const Checkpoint &, const QuorumCert &) {}
 
     public:
     HotStuffBase(uint32_t blk_size,
@@ -220,6 +673,14 @@ class HotStuffBase: public HotStuffCore {
 
     /* Submit the command to be decided. */
     void exec_command(uint256_t cmd_hash, commit_cb_t callback);
+    /** Submit the command with sequence number `seq` of client `cid`, where
+     * the sequence numbers of a client increase. A retry of a command still
+     * being decided only adds the callback, and one of the last executed
+     * command of the client is answered with the cached reply (older ones
+     * with decision 0), so neither is proposed again. The session table
+     * only learns from the commands submitted to this replica. */
+    void exec_command(uint256_t cmd_hash, uint32_t cid, uint64_t seq,
+                    commit_cb_t callback);
     void start(std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> &&replicas,
                 bool ec_loop = false);
 
@@ -227,6 +688,141 @@ class HotStuffBase: public HotStuffCore {
     const auto &get_decision_waiting() const { return decision_waiting; }
     ThreadCall &get_tcall() { return tcall; }
     PaceMaker *get_pace_maker() { return pmaker.get(); }
+    /** Enable automatic pruning, keeping `staleness` committed blocks below
+     * the last executed one, and spending at most `budget` seconds on it in
+     * each event loop iteration. */
+    void set_prune(uint32_t staleness, double budget) {
+        set_prune_staleness(staleness);
+        prune_budget = budget;
+    }
+    /** Log all committed blocks to `dir` (see BlockLog). The writes are
+     * batched on a dedicated thread. */
+    void set_blk_log(const std::string &dir,
+                    const BlockLog::Config &config = BlockLog::Config()) {
+        blk_log = new BlockLogWriter(dir, config);
+    }
+    /** Stream the committed blocks to the consumers connecting to
+     * `listen_addr` (see CommitFeed), keeping the last `max_records` of them
+     * for the consumers to resume from. */
+    void set_commit_feed(const NetAddr &listen_addr, size_t max_records = 65536) {
+        commit_feed = new CommitFeed(listen_addr, max_records);
+    }
+    /** Reject the commands committed within the last `window` heights (at
+     * least), at ingestion and upon proposing. The filter is probabilistic:
+     * a new command is rejected (with decision = 0) by mistake with
+     * probability around `fp_rate`, so the clients should retry such a
+     * command with a different hash. */
+    void set_replay_filter(uint32_t window, double fp_rate = 1e-6) {
+        committed_filter = new RotatingBloomFilter(
+            (size_t)window * blk_size, fp_rate, window);
+    }
+    /** Keep a warm-start snapshot of the consensus state in `path`, written
+     * every `period` seconds and upon `save_snapshot()`. It is loaded (if
+     * it exists) by `start()`, so a restarted replica resumes without
+     * re-fetching the uncommitted blocks. As the snapshot may be older
+     * than the last vote, the vote state is also synced to `path`.vote
+     * before each vote. */
+    void set_snapshot(const std::string &path, double period) {
+        snapshot_path = path;
+        snapshot_period = period;
+    }
+    /** Write the snapshot now (e.g., upon shutdown). */
+    void save_snapshot();
+    /** Sign the votes with `nworker` threads instead of the event loop
+     * (should be called before `start()`). */
+    void set_nsigner(size_t nworker) {
+        if (nworker) spool = new SignPool(ec, nworker);
+    }
+    /** Coalesce the votes and block fetch messages for the same peer
+     * within `delay` seconds (or up to `max_bytes` bytes) into one frame. */
+    void set_batching(double delay, size_t max_bytes) {
+        batch_delay = delay;
+        batch_max_bytes = max_bytes;
+    }
+    /** Compress the proposals and block responses (including the batches
+     * carrying them) not smaller than `threshold` bytes, spending at most
+     * `budget` seconds of CPU per second (a zero budget only enables the
+     * decompression). `dict` is an optional dictionary, which should then
+     * be set on every replica, including those not compressing their own
+     * messages. The replicas exchange what they can decompress (see
+     * MsgCompressCaps), so a peer built without the compression or without
+     * the same dictionary is sent the messages uncompressed, with a
+     * warning. */
+    void set_compression(int level, size_t threshold, double budget,
+                        const bytearray_t &dict = bytearray_t()) {
+        compressor = new Compressor(level, dict);
+        compress_threshold = threshold;
+        compress_budget = budget;
+        compress_credit = budget;
+    }
+    /** Inject the faults in the schedule file `fname` (see FaultInjector)
+     * into the outgoing messages, drawing the random choices from `seed`. */
+    void set_fault_schedule(const std::string &fname, uint64_t seed) {
+        faults = new FaultInjector(ec, get_id(), seed);
+        faults->load(fname);
+    }
+    /** Feed the committed blocks to a learner at `addr` (with the TLS
+     * certificate hash `cert_hash`), should be called before `start()`. The
+     * learner is not part of the replica configuration, so it does not
+     * receive proposals or count towards a quorum. */
+    void add_learner(const NetAddr &addr, const uint256_t &cert_hash) {
+        learners.push_back(std::make_pair(addr, cert_hash));
+    }
+    /** Run as a non-voting learner instead of a replica (should be called
+     * before `start()`). The learner subscribes to the replicas in
+     * `sources` (by index), every `period` seconds, to receive the
+     * committed blocks with the proof of their commit, and executes them
+     * as the replicas do. It never proposes or votes, and can serve the
+     * reads (see `async_read_index()`). */
+    void set_learner(const std::vector<ReplicaID> &sources, double period = 1) {
+        learn_sources = sources;
+        learn_period = period;
+    }
+    bool is_learner() const { return !learn_sources.empty(); }
+    /** Propose only the block headers and send the bodies right after, so
+     * that the other replicas check the proposal (and sign their votes)
+     * while the body is still in transfer. A vote is only sent once the body
+     * has arrived, or has been fetched from any replica if it is lost. */
+    void set_header_first(bool enabled) { header_first = enabled; }
+    /** Fetch at most `nmax` blocks at a time for delivering the blocks
+     * (e.g., the ancestors of a proposal when catching up). */
+    void set_delivery_fetch_limit(size_t nmax) {
+        max_delivery_fetch = std::max(nmax, (size_t)1);
+    }
+    /** Catch up with a long missing range of committed blocks in segments
+     * of `nblks` heights, requested in parallel from different replicas
+     * instead of walking the chain block by block from one of them. The
+     * range ends at the last executed block of a replica (the tip), whose
+     * commit proof is checked; the segments are then checked to link by
+     * the parent hashes down from the tip, and a segment is asked from
+     * another replica if it does not link or arrive in `timeout` seconds.
+     * A replica starts it when `nblks` fetched blocks wait for their
+     * parents, and a learner before each (re-)subscription (see
+     * `set_learner()`). 0 disables it. */
+    void set_swarm_sync(uint32_t nblks, double timeout = 5) {
+        sync_segment_size = std::min(nblks, sync_segment_limit);
+        sync_timeout = timeout;
+    }
+    /** Serve the reads (see `async_read_index()`), which also keeps the
+     * digest of the executed state returned with them. It should be set
+     * the same way on all replicas from the start, for their digests to
+     * match. */
+    void set_read_index(bool enabled) { read_index_enabled = enabled; }
+    /** Fail a read (see `async_read_index()`) after `timeout` seconds. */
+    void set_read_timeout(double timeout) { read_timeout = timeout; }
+    /** Returns a promise resolved (with bool ok) when the local state is
+     * fresh enough to serve a linearizable read, i.e., it reflects every
+     * command committed before this call. The replica asks a quorum for the
+     * heights they last voted for: any committed block is below a block
+     * voted by at least one correct replica in the quorum, by the commit
+     * depth. So the read index is the highest reported height minus the
+     * commit depth, and the read is ready once the execution reaches it.
+     * The replies are trusted to come from the replicas they are received
+     * from, so TLS should be enabled. It resolves with false if no quorum
+     * replies or no block reaching the index is committed in time (e.g.,
+     * the system is idle), and right away if the reads are disabled (see
+     * `set_read_index()`). */
+    promise_t async_read_index();
     void print_stat() const;
     virtual void do_elected() {}
 //#ifdef HOTSTUFF_AUTOCLI
@@ -238,7 +834,10 @@ class HotStuffBase: public HotStuffCore {
     promise_t async_fetch_cmd(const uint256_t &cmd_hash, const NetAddr *replica_id, bool fetch_now = true);
     /** Returns a promise resolved (with block_t blk) when Block is fetched. */
     promise_t async_fetch_blk(const uint256_t &blk_hash, const NetAddr *replica_id, bool fetch_now = true);
-    /** Returns a promise resolved (with block_t blk) when Block is delivered (i.e. prefix is fetched). */
+    /** Returns a promise resolved (with block_t blk) when Block is delivered (i.e. prefix is fetched).
+     * The missing ancestors are tracked in a dependency graph rather than
+     * chained promises, fetched within the limit and delivered as soon as
+     * their parents are. */
     promise_t async_deliver_blk(const uint256_t &blk_hash,  const NetAddr &replica_id);
 };
 
@@ -309,6 +908,81 @@ class HotStuff: public HotStuffBase {
 using HotStuffNoSig = HotStuff<>;
 using HotStuffSecp256k1 = HotStuff<PrivKeySecp256k1, PubKeySecp256k1,
                                     PartCertSecp256k1, QuorumCertSecp256k1>;
+using HotStuffEd25519 = HotStuff<PrivKeyEd25519, PubKeyEd25519,
+                                PartCertEd25519, QuorumCertEd25519>;
+
+template<typename MsgType>
+void HotStuffBase::send_msg(MsgType &&msg, const NetAddr &addr) {
+    auto it = peer_rid.find(addr);
+    if (!faults || it == peer_rid.end())
+    {
+        transmit_msg(std::forward<MsgType>(msg), addr);
+        return;
+    }
+    auto v = faults->judge(it->second, std::decay_t<MsgType>::opcode);
+    if (v.ncopies == 0) return;
+    if (v.ncopies == 1 && v.delay == 0)
+    {
+        transmit_msg(std::forward<MsgType>(msg), addr);
+        return;
+    }
+    auto m = std::make_shared<std::decay_t<MsgType>>(std::forward<MsgType>(msg));
+    for (uint32_t i = 0; i < v.ncopies; i++)
+    {
+        if (v.delay > 0)
+            faults->defer(v.delay, [this, m, addr]() { transmit_msg(*m, addr); });
+        else
+            transmit_msg(*m, addr);
+    }
+}
+
+template<typename MsgType>
+void HotStuffBase::transmit_msg(MsgType &&msg, const NetAddr &addr) {
+    const opcode_t opcode = std::decay_t<MsgType>::opcode;
+    if (batch_delay > 0 &&
+        (opcode == MsgVote::opcode ||
+        opcode == MsgReqBlock::opcode ||
+        opcode == MsgRespBlock::opcode))
+        batch_msg(opcode, msg.serialized, addr);
+    else
+    {
+        BoxObj<MsgCompressed> c;
+        if (compress_to(addr)) c = compress_msg(opcode, msg.serialized);
+        if (c)
+            pn.send_msg(*c, addr);
+        else
+            pn.send_msg(std::forward<MsgType>(msg), addr);
+    }
+}
+
+template<typename MsgType>
+void HotStuffBase::multicast_msg(MsgType &&msg) {
+    if (!faults && batch_delay == 0)
+    {
+        if (!compress_enabled())
+        {
+            pn.multicast_msg(std::forward<MsgType>(msg), peers);
+            return;
+        }
+        /* compress only once for all peers able to decompress it */
+        std::vector<NetAddr> capable, plain;
+        for (const auto &peer: peers)
+            (compress_to(peer) ? capable : plain).push_back(peer);
+        BoxObj<MsgCompressed> c;
+        if (!capable.empty())
+            c = compress_msg(std::decay_t<MsgType>::opcode, msg.serialized);
+        if (c)
+        {
+            pn.multicast_msg(*c, capable);
+            if (!plain.empty()) pn.multicast_msg(msg, plain);
+        }
+        else
+            pn.multicast_msg(std::forward<MsgType>(msg), peers);
+        return;
+    }
+    for (const auto &peer: peers)
+        send_msg(msg, peer);
+}
 
 template<EntityType ent_type>
 FetchContext<ent_type>::FetchContext(FetchContext && other):
@@ -318,13 +992,13 @@ FetchContext<ent_type>::FetchContext(FetchContext && other):
         ent_hash(other.ent_hash),
         replica_ids(std::move(other.replica_ids)) {
     other.timeout.del();
-    timeout = TimerEvent(hs->ec,
+    timeout = WheelTimer(hs->ec,
             std::bind(&FetchContext::timeout_cb, this, _1));
     reset_timeout();
 }
 
 template<>
-inline void FetchContext<ENT_TYPE_CMD>::timeout_cb(TimerEvent &) {
+inline void FetchContext<ENT_TYPE_CMD>::timeout_cb(WheelTimer &) {
     HOTSTUFF_LOG_WARN("cmd fetching %.10s timeout", get_hex(ent_hash).c_str());
     for (const auto &replica_id: replica_ids)
         send(replica_id);
@@ -332,7 +1006,7 @@ inline void FetchContext<ENT_TYPE_CMD>::timeout_cb(TimerEvent &) {
 }
 
 template<>
-inline void FetchContext<ENT_TYPE_BLK>::timeout_cb(TimerEvent &) {
+inline void FetchContext<ENT_TYPE_BLK>::timeout_cb(WheelTimer &) {
     HOTSTUFF_LOG_WARN("block fetching %.10s timeout", get_hex(ent_hash).c_str());
     for (const auto &replica_id: replica_ids)
         send(replica_id);
@@ -346,7 +1020,7 @@ FetchContext<ent_type>::FetchContext(
             hs(hs), ent_hash(ent_hash) {
     fetch_msg = std::vector<uint256_t>{ent_hash};
 
-    timeout = TimerEvent(hs->ec,
+    timeout = WheelTimer(hs->ec,
             std::bind(&FetchContext::timeout_cb, this, _1));
     reset_timeout();
 }
@@ -354,7 +1028,7 @@ FetchContext<ent_type>::FetchContext(
 template<EntityType ent_type>
 void FetchContext<ent_type>::send(const NetAddr &replica_id) {
     hs->part_fetched_replica[replica_id]++;
-    hs->pn.send_msg(fetch_msg, replica_id);
+    hs->send_msg(fetch_msg, replica_id);
 }
 
 template<EntityType ent_type>
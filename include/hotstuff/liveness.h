@@ -71,12 +71,16 @@ class PMHighTail: public virtual PaceMaker {
         return b == _a;
     }
     
+    void update_hqc_tail(const block_t &hqc) {
+        hqc_tail = hqc;
+        for (const auto &tail: hsc->get_tails())
+            if (check_ancestry(hqc, tail) && tail->get_height() > hqc_tail->get_height())
+                hqc_tail = tail;
+    }
+
     void reg_hqc_update() {
         hsc->async_hqc_update().then([this](const block_t &hqc) {
-            hqc_tail = hqc;
-            for (const auto &tail: hsc->get_tails())
-                if (check_ancestry(hqc, tail) && tail->get_height() > hqc_tail->get_height())
-                    hqc_tail = tail;
+            update_hqc_tail(hqc);
             reg_hqc_update();
         });
     }
@@ -101,7 +105,8 @@ class PMHighTail: public virtual PaceMaker {
     public:
     PMHighTail(int32_t parent_limit): parent_limit(parent_limit) {}
     void init() {
-        hqc_tail = hsc->get_genesis();
+        /* the core may have been restored from a snapshot */
+        update_hqc_tail(hsc->get_hqc());
         reg_hqc_update();
         reg_proposal();
         reg_receive_proposal();
@@ -233,7 +238,7 @@ class PMRoundRobinProposer: virtual public PaceMaker {
     double prop_delay;
     EventContext ec;
     /** QC timer or randomized timeout */
-    TimerEvent timer;
+    WheelTimer timer;
     /** the proposer it believes */
     ReplicaID proposer;
     std::unordered_map<ReplicaID, block_t> prop_blk;
@@ -304,10 +309,10 @@ class PMRoundRobinProposer: virtual public PaceMaker {
             });
     }
 
-    void on_exp_timeout(TimerEvent &) {
+    void on_exp_timeout(WheelTimer &) {
         if (proposer == hsc->get_id())
             do_new_consensus(0, std::vector<uint256_t>{});
-        timer = TimerEvent(ec, [this](TimerEvent &){ rotate(); });
+        timer = WheelTimer(ec, [this](WheelTimer &){ rotate(); });
         timer.add(prop_delay);
     }
 
@@ -324,7 +329,7 @@ class PMRoundRobinProposer: virtual public PaceMaker {
         pm_wait_propose.reject();
         pm_qc_manual.reject();
         // start timer
-        timer = TimerEvent(ec, salticidae::generic_bind(&PMRoundRobinProposer::on_exp_timeout, this, _1));
+        timer = WheelTimer(ec, salticidae::generic_bind(&PMRoundRobinProposer::on_exp_timeout, this, _1));
         timer.add(exp_timeout);
         exp_timeout *= 2;
     }
@@ -0,0 +1,69 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_MERKLE_H
+#define _HOTSTUFF_MERKLE_H
+
+#include <vector>
+
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+/** Get the root of the Merkle tree over `leaves`. A leaf node is
+ * H(0x00 || leaf) and an inner node is H(0x01 || left || right), while an
+ * unpaired node is carried up unchanged (rather than paired with itself),
+ * so that no two different lists share a root. The root of an empty list is
+ * zero. */
+uint256_t merkle_root(const std::vector<uint256_t> &leaves);
+
+/** Proof of the inclusion of a leaf in a Merkle tree. */
+struct MerkleProof: public Serializable {
+    /** position of the leaf */
+    uint32_t index;
+    /** number of leaves in the tree */
+    uint32_t nleaves;
+    /** the sibling nodes from the bottom up */
+    std::vector<uint256_t> siblings;
+
+    MerkleProof(): index(0), nleaves(0) {}
+
+    void serialize(DataStream &s) const override;
+    void unserialize(DataStream &s) override;
+
+    /** Check that `leaf` is the `index`-th of `nleaves` leaves under
+     * `root`. */
+    bool verify(const uint256_t &leaf, const uint256_t &root) const;
+};
+
+/** All levels of a Merkle tree (see `merkle_root()`), kept to generate the
+ * proofs for many leaves. */
+class MerkleTree {
+    std::vector<std::vector<uint256_t>> levels;
+
+    public:
+    MerkleTree() = default;
+    MerkleTree(const std::vector<uint256_t> &leaves);
+
+    uint256_t get_root() const;
+    /** Prove the inclusion of the `index`-th leaf. */
+    MerkleProof prove(uint32_t index) const;
+};
+
+}
+
+#endif
@@ -100,6 +100,8 @@ class VeriPool {
             w.handle.join();
     }
 
+    size_t get_nworker() const { return workers.size(); }
+
     promise_t verify(veritask_ut &&task) {
         auto ptr = task.get();
         auto ret = pms.insert(std::make_pair(ptr,
@@ -110,6 +112,89 @@ class VeriPool {
     }
 };
 
+class SignTask {
+    public:
+    virtual void sign() = 0;
+    virtual ~SignTask() = default;
+};
+
+using signtask_ut = BoxObj<SignTask>;
+using sign_mpmc_queue_t = salticidae::MPMCQueueEventDriven<SignTask *>;
+using sign_mpsc_queue_t = salticidae::MPSCQueueEventDriven<SignTask *>;
+
+/** The signing counterpart of VeriPool: runs the tasks on worker threads
+ * and resolves the promise (on the thread of `ec`) when a task is done. The
+ * task is still alive during the callbacks of the promise, so the result can
+ * be taken out from the task. */
+class SignPool {
+    sign_mpmc_queue_t in_queue;
+    sign_mpsc_queue_t out_queue;
+
+    struct Worker {
+        std::thread handle;
+        EventContext ec;
+        BoxObj<ThreadCall> tcall;
+    };
+
+    std::vector<Worker> workers;
+    std::unordered_map<SignTask *, std::pair<signtask_ut, promise_t>> pms;
+
+    public:
+    SignPool(EventContext ec, size_t nworker, size_t burst_size = 128) {
+        out_queue.reg_handler(ec, [this, burst_size](sign_mpsc_queue_t &q) {
+            size_t cnt = burst_size;
+            SignTask *task;
+            while (q.try_dequeue(task))
+            {
+                auto it = pms.find(task);
+                it->second.second.resolve();
+                pms.erase(it);
+                if (!--cnt) return true;
+            }
+            return false;
+        });
+
+        workers.resize(nworker);
+        for (size_t i = 0; i < nworker; i++)
+        {
+            in_queue.reg_handler(workers[i].ec, [this, burst_size](sign_mpmc_queue_t &q) {
+                size_t cnt = burst_size;
+                SignTask *task;
+                while (q.try_dequeue(task))
+                {
+                    task->sign();
+                    out_queue.enqueue(task);
+                    if (!--cnt) return true;
+                }
+                return false;
+            });
+        }
+        for (auto &w: workers)
+        {
+            w.tcall = new ThreadCall(w.ec);
+            w.handle = std::thread([ec=w.ec]() { ec.dispatch(); });
+        }
+    }
+
+    ~SignPool() {
+        for (auto &w: workers)
+            w.tcall->async_call([ec=w.ec](ThreadCall::Handle &) {
+                ec.stop();
+            });
+        for (auto &w: workers)
+            w.handle.join();
+    }
+
+    promise_t sign(signtask_ut &&task) {
+        auto ptr = task.get();
+        auto ret = pms.insert(std::make_pair(ptr,
+                std::make_pair(std::move(task), promise_t([](promise_t &){}))));
+        assert(ret.second);
+        in_queue.enqueue(ptr);
+        return ret.first->second.second;
+    }
+};
+
 }
 
 #endif
@@ -0,0 +1,130 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _HOTSTUFF_TIMER_H
+#define _HOTSTUFF_TIMER_H
+
+#include <chrono>
+#include <memory>
+#include <functional>
+
+#include "salticidae/event.h"
+#include "hotstuff/type.h"
+
+namespace hotstuff {
+
+class WheelTimer;
+
+/** Hierarchical timer wheel (as in the classic kernel timers), driving any
+ * number of WheelTimers with a single TimerEvent. Adding or cancelling a
+ * timer is O(1), and the timers expiring in the same tick are run as a
+ * batch. The expiration is rounded up to the tick `resolution`, so it
+ * suits the timeouts rather than the precise delays. A wheel is shared by
+ * the timers of the same event context (see `get()`). */
+class TimerWheel {
+    friend WheelTimer;
+    struct Node {
+        Node *prev, *next;
+        WheelTimer *owner;
+        std::function<void(WheelTimer &)> callback;
+        uint64_t expire;
+        /** being run: a timer destroyed by its own callback leaves the
+         * node to be freed afterwards */
+        bool firing;
+        bool dead;
+        Node(): prev(this), next(this), owner(nullptr),
+                expire(0), firing(false), dead(false) {}
+        bool linked() const { return next != this; }
+        void unlink() {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = this;
+        }
+    };
+    static const int level_bits = 8;
+    static const uint64_t level_size = 1 << level_bits;
+    static const uint64_t level_mask = level_size - 1;
+    static const int nlevels = 4;
+
+    EventContext ec;
+    double resolution;
+    std::chrono::steady_clock::time_point start;
+    /** the sentinels of the slot lists */
+    Node slots[nlevels][level_size];
+    /** the next tick to process */
+    uint64_t base;
+    size_t count;
+    TimerEvent tick_timer;
+    /** whether `tick_timer` is set, and to which tick */
+    bool armed;
+    uint64_t armed_tick;
+
+    /** The current time in ticks. */
+    double now_time() const {
+        std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+        return d.count() / resolution;
+    }
+    uint64_t now_tick() const { return (uint64_t)now_time(); }
+    void place(Node *node);
+    void schedule(Node *node, double t);
+    void cancel(Node *node);
+    bool cascade(int level);
+    void on_tick();
+    /** Set the tick timer for the next non-empty slot (or cascade). */
+    void rearm();
+
+    public:
+    TimerWheel(const EventContext &ec, double resolution = 0.01);
+    TimerWheel(const TimerWheel &) = delete;
+
+    /** The wheel of the event context `ec` (created upon the first use).
+     * The timers of an event context should be used by its own thread. */
+    static std::shared_ptr<TimerWheel> get(const EventContext &ec);
+
+    /** The number of the pending timers. */
+    size_t size() const { return count; }
+};
+
+/** A timer driven by the TimerWheel of its event context, used like a
+ * TimerEvent. */
+class WheelTimer {
+    friend TimerWheel;
+    std::shared_ptr<TimerWheel> wheel;
+    TimerWheel::Node *node;
+
+    public:
+    using callback_t = std::function<void(WheelTimer &)>;
+
+    WheelTimer(): node(nullptr) {}
+    WheelTimer(const EventContext &ec, callback_t callback);
+    WheelTimer(const WheelTimer &) = delete;
+    WheelTimer(WheelTimer &&other);
+    WheelTimer &operator=(WheelTimer &&other);
+    ~WheelTimer() { clear(); }
+
+    /** (Re-)arm the timer to expire in `t` seconds. */
+    void add(double t);
+    /** Disarm the timer. */
+    void del();
+    /** Disarm the timer and drop the callback. */
+    void clear();
+    bool is_pending() const { return node && node->linked(); }
+};
+
+}
+
+#endif
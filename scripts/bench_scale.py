@@ -0,0 +1,150 @@
+import os, re
+import csv
+import time
+import shutil
+import signal
+import itertools
+import subprocess
+import argparse
+
+# Sweep the number of replicas, block size, number of verification workers and
+# command payload size on localhost, and write one CSV row per configuration.
+#
+# The payload size is a compile-time constant (HOTSTUFF_CMD_REQSIZE), so a
+# separate build tree is configured for each non-zero payload size.
+
+log_pat = re.compile(r'([^[].*) \[hotstuff info\] (.*)$')
+lat_pat = re.compile(r'(?:.*wall: )?([0-9.]+)(?:, cpu: [0-9.]+)?$')
+sentb_pat = re.compile(r'sent bytes: ([0-9]+)$')
+clk_tck = os.sysconf('SC_CLK_TCK')
+
+def int_list(s):
+    return [int(x) for x in s.split(',')]
+
+def get_cpu_time(pid):
+    with open('/proc/{}/stat'.format(pid)) as f:
+        # skip the command name, which may contain spaces
+        fields = f.read().rsplit(')', 1)[1].split()
+    # utime and stime are the 14th and 15th fields
+    return (int(fields[11]) + int(fields[12])) / clk_tck
+
+def get_build(args, payload):
+    if payload == 0:
+        return args.build_dir
+    build = os.path.join(args.work_dir, 'build-payload{}'.format(payload))
+    if not os.path.exists(os.path.join(build, 'examples', 'hotstuff-app')):
+        flags = '-DHOTSTUFF_CMD_REQSIZE={0} -DHOTSTUFF_CMD_RESPSIZE={0}'.format(payload)
+        subprocess.check_call(['cmake', '-S', args.src_dir, '-B', build,
+                                '-DCMAKE_BUILD_TYPE=Release',
+                                '-DCMAKE_CXX_FLAGS={}'.format(flags)])
+        subprocess.check_call(['cmake', '--build', build, '-j', str(os.cpu_count())])
+    return build
+
+def run(args, build, n, blk_size, nworker):
+    run_dir = os.path.join(args.work_dir, 'run')
+    shutil.rmtree(run_dir, ignore_errors=True)
+    os.makedirs(run_dir)
+    prefix = os.path.join(run_dir, 'hotstuff')
+    subprocess.check_call(['python3', os.path.join(args.src_dir, 'scripts', 'gen_conf.py'),
+                            '--prefix', prefix, '--iter', str(n),
+                            '--block-size', str(blk_size),
+                            '--pace-maker', args.pace_maker,
+                            '--keygen', os.path.join(build, 'hotstuff-keygen'),
+                            '--tls-keygen', os.path.join(build, 'hotstuff-tls-keygen'),
+                            '--nodes', os.path.join(run_dir, 'nodes.txt')])
+    app = os.path.abspath(os.path.join(build, 'examples', 'hotstuff-app'))
+    client = os.path.abspath(os.path.join(build, 'examples', 'hotstuff-client'))
+    replicas = []
+    for i in range(n):
+        log = open(os.path.join(run_dir, 'log{}'.format(i)), 'w')
+        replicas.append(subprocess.Popen(
+            [app, '--conf', 'hotstuff-sec{}.conf'.format(i),
+                '--nworker', str(nworker), '--stat-period', '1'],
+            cwd=run_dir, stdout=log, stderr=subprocess.STDOUT))
+    time.sleep(1)
+    clients = []
+    for i in range(args.nclient):
+        log = open(os.path.join(run_dir, 'clog{}'.format(i)), 'w')
+        clients.append(subprocess.Popen(
+            [client, '--idx', str(i % n), '--cid', str(i),
+                '--iter', '-1', '--max-async', str(args.max_async)],
+            cwd=run_dir, stdout=log, stderr=subprocess.STDOUT))
+    time.sleep(args.duration)
+    cpu = [get_cpu_time(p.pid) for p in replicas]
+    for p in clients + replicas:
+        p.send_signal(signal.SIGINT)
+    for p in clients + replicas:
+        try:
+            p.wait(timeout=5)
+        except subprocess.TimeoutExpired:
+            p.kill()
+
+    commits = []
+    for i in range(args.nclient):
+        with open(os.path.join(run_dir, 'clog{}'.format(i))) as f:
+            for line in f:
+                m = log_pat.match(line.rstrip('\n'))
+                if not m: continue
+                m2 = lat_pat.match(m.group(2))
+                if m2: commits.append((m.group(1), float(m2.group(1))))
+    commits.sort()
+    # drop the commits during the warm-up
+    commits = commits[int(len(commits) * args.warmup / args.duration):]
+    lats = sorted(c[1] for c in commits)
+    sent_bytes = 0
+    for i in range(n):
+        last = 0
+        with open(os.path.join(run_dir, 'log{}'.format(i))) as f:
+            for line in f:
+                m = sentb_pat.search(line)
+                if m: last = int(m.group(1))
+        sent_bytes += last
+    def percentile(p):
+        return lats[min(int(len(lats) * p), len(lats) - 1)] * 1e3 if lats else 0
+    nall = len(lats) / (1 - args.warmup / args.duration)
+    return {
+        'throughput': len(lats) / (args.duration - args.warmup),
+        'p50_ms': percentile(0.5),
+        'p99_ms': percentile(0.99),
+        'cpu_per_replica': sum(cpu) / n / args.duration,
+        'bytes_per_commit': sent_bytes / nall if nall else 0,
+    }
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Benchmark a sweep of replica configurations on localhost')
+    parser.add_argument('--src-dir', type=str, default='.')
+    parser.add_argument('--build-dir', type=str, default='.')
+    parser.add_argument('--work-dir', type=str, default='bench')
+    parser.add_argument('--output', type=str, default='bench.csv')
+    parser.add_argument('--nreplicas', type=int_list, default=[4])
+    parser.add_argument('--block-sizes', type=int_list, default=[1])
+    parser.add_argument('--nworkers', type=int_list, default=[1])
+    parser.add_argument('--payloads', type=int_list, default=[0])
+    parser.add_argument('--nclient', type=int, default=1)
+    parser.add_argument('--max-async', type=int, default=4)
+    parser.add_argument('--pace-maker', type=str, default='dummy')
+    parser.add_argument('--duration', type=float, default=20)
+    parser.add_argument('--warmup', type=float, default=5)
+    args = parser.parse_args()
+    args.src_dir = os.path.abspath(args.src_dir)
+    args.build_dir = os.path.abspath(args.build_dir)
+    args.work_dir = os.path.abspath(args.work_dir)
+    os.makedirs(args.work_dir, exist_ok=True)
+
+    fields = ['nreplicas', 'block_size', 'nworker', 'payload',
+            'throughput', 'p50_ms', 'p99_ms', 'cpu_per_replica', 'bytes_per_commit']
+    with open(args.output, 'w', newline='') as out:
+        writer = csv.DictWriter(out, fieldnames=fields)
+        writer.writeheader()
+        for payload in args.payloads:
+            build = get_build(args, payload)
+            for n, blk_size, nworker in itertools.product(
+                    args.nreplicas, args.block_sizes, args.nworkers):
+                print("n = {}, block size = {}, nworker = {}, payload = {}".format(
+                        n, blk_size, nworker, payload))
+                row = run(args, build, n, blk_size, nworker)
+                row.update({'nreplicas': n, 'block_size': blk_size,
+                            'nworker': nworker, 'payload': payload})
+                print(row)
+                writer.writerow(row)
+                out.flush()
@@ -0,0 +1,102 @@
+# Report the throughput dips, recovery time and view changes around each
+# window of a fault schedule, from the logs of the replicas and a client.
+#
+# The client log is either the per-command lines ("got <fin ...>, wall: ...")
+# of a normal build, or the latencies printed at exit by a benchmark build.
+# The view changes are counted by the impeachments, which are logged by
+# default; the further rotations of the round-robin pace maker within a view
+# change are only counted if the replicas are built with HOTSTUFF_PROTO_LOG.
+import re
+import argparse
+from datetime import datetime
+
+log_pat = re.compile(r'([^[].*) \[hotstuff (\w+)\] (.*)$')
+lat_pat = re.compile(r'(?:got <fin .*>, wall: )?([0-9.]+)$')
+
+def str2datetime(s):
+    parts = s.split('.')
+    dt = datetime.strptime(parts[0], "%Y-%m-%d %H:%M:%S")
+    return dt.replace(microsecond=int(parts[1]))
+
+def read_log(fname):
+    with open(fname) as f:
+        for line in f:
+            m = log_pat.match(line.rstrip('\n'))
+            if m:
+                yield str2datetime(m.group(1)), m.group(2), m.group(3)
+
+def read_schedule(fname):
+    windows = []
+    with open(fname) as f:
+        for line in f:
+            fields = line.split('#')[0].split()
+            if len(fields) < 3:
+                continue
+            windows.append((float(fields[0]), float(fields[1]), ' '.join(fields[2:])))
+    return windows
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--schedule', type=str, required=True)
+    parser.add_argument('--client', type=str, required=True)
+    parser.add_argument('--interval', type=float, default=1, required=False)
+    parser.add_argument('--warmup', type=float, default=2, required=False)
+    parser.add_argument('--recovered', type=float, default=0.9, required=False,
+                        help="fraction of the baseline throughput deemed recovered")
+    parser.add_argument('replica_logs', nargs='+')
+    args = parser.parse_args()
+
+    # the schedule is relative to the time the injection started
+    t0 = None
+    view_changes = []
+    for fname in args.replica_logs:
+        for ts, _, msg in read_log(fname):
+            if msg.startswith('fault injection started'):
+                t0 = min(t0, ts) if t0 else ts
+            elif 'impeach the proposer' in msg or 'rotate to' in msg:
+                view_changes.append(ts)
+    if t0 is None:
+        raise SystemExit("fault injection was not started in the replica logs")
+    view_changes = [(ts - t0).total_seconds() for ts in view_changes]
+
+    commits = []
+    lats = []
+    for ts, level, msg in read_log(args.client):
+        m = lat_pat.match(msg)
+        if level == 'info' and m:
+            commits.append((ts - t0).total_seconds())
+            lats.append(float(m.group(1)))
+    if not commits:
+        raise SystemExit("no commits in the client log")
+
+    nbuckets = int(max(commits) / args.interval) + 1
+    thr = [0] * nbuckets
+    for t in commits:
+        if t >= 0:
+            thr[int(t / args.interval)] += 1
+    thr = [c / args.interval for c in thr]
+    def at(t):
+        return int(t / args.interval)
+
+    windows = read_schedule(args.schedule)
+    first = min(w[0] for w in windows)
+    base = thr[at(args.warmup):at(first)]
+    baseline = sum(base) / len(base) if base else 0
+    print("throughput (tx/sec per {}s): {}".format(args.interval, thr))
+    print("baseline: {:.1f} tx/sec, avg. latency {:.3f}ms".format(
+        baseline, sum(lats) / len(lats) * 1e3))
+    for start, end, rule in windows:
+        during = thr[at(start):at(end)] or [0]
+        recovery = None
+        for i in range(at(end), nbuckets):
+            if thr[i] >= baseline * args.recovered:
+                recovery = max(i * args.interval - end, 0)
+                break
+        nvc = sum(1 for t in view_changes if start <= t < end + (recovery or 0))
+        print("[{:g}, {:g}) {}:".format(start, end, rule))
+        print("  throughput: {:.1f} avg, {:.1f} min ({:.0f}% dip)".format(
+            sum(during) / len(during), min(during),
+            (1 - min(during) / baseline) * 100 if baseline else 0))
+        print("  recovery: {}".format(
+            "{:.1f}s".format(recovery) if recovery is not None else "not recovered"))
+        print("  view changes: {}".format(nvc))
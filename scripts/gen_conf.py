@@ -15,6 +15,8 @@ if __name__ == "__main__":
     parser.add_argument('--nodes', type=str, default='nodes.txt')
     parser.add_argument('--block-size', type=int, default=1)
     parser.add_argument('--pace-maker', type=str, default='dummy')
+    parser.add_argument('--algo', type=str, default='secp256k1')
+    parser.add_argument('--learners', type=int, default=0)
     args = parser.parse_args()
 
 
@@ -34,10 +36,15 @@ if __name__ == "__main__":
     replicas = ["{}:{};{}".format(ip, base_pport + i, base_cport + i)
                 for ip in ips
                 for i in range(iter)]
-    p = subprocess.Popen([keygen_bin, '--num', str(len(replicas))],
+    learners = ["{}:{};{}".format(ips[i % len(ips)],
+                                    base_pport + len(replicas) + i,
+                                    base_cport + len(replicas) + i)
+                for i in range(args.learners)]
+    nkeys = len(replicas) + len(learners)
+    p = subprocess.Popen([keygen_bin, '--num', str(nkeys), '--algo', args.algo],
                         stdout=subprocess.PIPE, stderr=open(os.devnull, 'w'))
     keys = [[t[4:] for t in l.decode('ascii').split()] for l in p.stdout]
-    tls_p = subprocess.Popen([tls_keygen_bin, '--num', str(len(replicas))],
+    tls_p = subprocess.Popen([tls_keygen_bin, '--num', str(nkeys)],
                         stdout=subprocess.PIPE, stderr=open(os.devnull, 'w'))
     tls_keys = [[t[4:] for t in l.decode('ascii').split()] for l in tls_p.stdout]
     if not (args.block_size is None):
@@ -53,3 +60,14 @@ if __name__ == "__main__":
         r_conf.write("tls-privkey = {}\n".format(r[2][1]))
         r_conf.write("tls-cert = {}\n".format(r[2][0]))
         r_conf.write("idx = {}\n".format(r[3]))
+    for i, l in enumerate(learners):
+        key = keys[len(replicas) + i]
+        tls_key = tls_keys[len(replicas) + i]
+        main_conf.write("learner = {}, {}\n".format(l, tls_key[2]))
+        l_conf_name = "{}-learner{}.conf".format(prefix, i)
+        l_conf = open(l_conf_name, 'w')
+        l_conf.write("privkey = {}\n".format(key[1]))
+        l_conf.write("tls-privkey = {}\n".format(tls_key[1]))
+        l_conf.write("tls-cert = {}\n".format(tls_key[0]))
+        l_conf.write("learner-addr = {}\n".format(l))
+        l_conf.write("learn-from = {}\n".format(i % len(replicas)))
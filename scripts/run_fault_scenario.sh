@@ -0,0 +1,35 @@
+#!/bin/bash
+# Run the demo replicas with a fault schedule for each pace maker, and report
+# the throughput dips, recovery time and view changes.
+#
+# usage: run_fault_scenario.sh <schedule> [duration] [seed] [pace maker...]
+sched="$1"
+duration="${2:-40}"
+seed="${3:-0}"
+# the pace makers only follow all three
+shift $(( $# < 3 ? $# : 3 ))
+pmakers=("$@")
+if [[ ${#pmakers[@]} -eq 0 ]]; then
+    pmakers=(dummy rr)
+fi
+if [[ ! -f "$sched" ]]; then
+    echo "usage: $0 <schedule> [duration] [seed] [pace maker...]"
+    exit 1
+fi
+for pm in "${pmakers[@]}"; do
+    echo "===== pace maker: $pm ====="
+    pids=()
+    for i in {0..3}; do
+        ./examples/hotstuff-app --conf ./hotstuff-sec${i}.conf \
+            --pace-maker "$pm" --fault-schedule "$sched" --fault-seed "$seed" \
+            > "fault-log${i}" 2>&1 &
+        pids+=($!)
+    done
+    sleep 1
+    ./examples/hotstuff-client --idx 0 --iter -1 --max-async 4 > fault-clog 2>&1 &
+    pids+=($!)
+    sleep "$duration"
+    kill "${pids[@]}"
+    wait
+    python3 scripts/fault_report.py --schedule "$sched" --client fault-clog fault-log{0..3}
+done
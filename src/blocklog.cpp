@@ -0,0 +1,390 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "hotstuff/util.h"
+#include "hotstuff/blocklog.h"
+
+namespace hotstuff {
+
+static const size_t idx_init_cap = 4096;
+static const size_t read_chunk_size = 1 << 20;
+
+static inline void put_le32(uint8_t *p, uint32_t x) {
+    p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+static inline uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+            ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t crc32(const uint8_t *data, size_t len) {
+    /* initialized once, thread-safely, on the first call */
+    static const std::array<uint32_t, 256> table = []() {
+        std::array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t c = 0xffffffff;
+    for (size_t i = 0; i < len; i++)
+        c = table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    return c ^ 0xffffffff;
+}
+
+/* Scan a segment from the beginning and return the end of the last valid
+ * record. */
+template<typename Func>
+static uint64_t scan_seg(int fd, Func on_record) {
+    off_t fsize = lseek(fd, 0, SEEK_END);
+    uint64_t off = 0;
+    uint8_t hdr[BlockLog::header_size];
+    bytearray_t payload;
+    while (off + BlockLog::header_size <= (uint64_t)fsize)
+    {
+        if (pread(fd, hdr, sizeof hdr, off) != sizeof hdr) break;
+        uint32_t len = get_le32(hdr);
+        if (len > BlockLog::max_record_size ||
+            off + sizeof hdr + len > (uint64_t)fsize) break;
+        payload.resize(len);
+        if (pread(fd, payload.data(), len, off + sizeof hdr) != (ssize_t)len) break;
+        if (crc32(payload.data(), len) != get_le32(hdr + 8)) break;
+        on_record(get_le32(hdr + 4), off);
+        off += sizeof hdr + len;
+    }
+    return off;
+}
+
+BlockLog::BlockLog(const std::string &dir, const Config &config):
+        dir(dir), config(config),
+        seg_fd(-1), tail_seg(0), tail_offset(0),
+        tail_height(0), last_indexed(0),
+        idx_fd(-1), idx(nullptr), idx_size(0), idx_cap(0) {
+    if (mkdir(dir.c_str(), 0755) && errno != EEXIST)
+        throw HotStuffError("cannot create %s: %s", dir.c_str(), strerror(errno));
+    auto idx_path = dir + "/blk.idx";
+    idx_fd = open(idx_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (idx_fd < 0)
+        throw HotStuffError("cannot open %s: %s", idx_path.c_str(), strerror(errno));
+    struct stat st;
+    fstat(idx_fd, &st);
+    map_index(std::max((size_t)st.st_size / sizeof(IndexEntry), idx_init_cap));
+    /* the index entries are densely packed and heights are never 0 */
+    while (idx_size < idx_cap && idx[idx_size].height) idx_size++;
+    recover();
+}
+
+BlockLog::~BlockLog() {
+    try {
+        flush();
+    } catch (std::exception &err) {
+        HOTSTUFF_LOG_WARN("failed to flush the block log: %s", err.what());
+    }
+    if (seg_fd >= 0) close(seg_fd);
+    if (idx) munmap(idx, idx_cap * sizeof(IndexEntry));
+    if (idx_fd >= 0) close(idx_fd);
+}
+
+std::string BlockLog::seg_path(uint32_t seg) const {
+    char name[32];
+    snprintf(name, sizeof name, "/blk-%08u.log", seg);
+    return dir + name;
+}
+
+void BlockLog::open_seg(uint32_t seg) {
+    if (seg_fd >= 0) close(seg_fd);
+    auto path = seg_path(seg);
+    seg_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (seg_fd < 0)
+        throw HotStuffError("cannot open %s: %s", path.c_str(), strerror(errno));
+    tail_seg = seg;
+}
+
+void BlockLog::map_index(size_t cap) {
+    if (idx) munmap(idx, idx_cap * sizeof(IndexEntry));
+    if (ftruncate(idx_fd, cap * sizeof(IndexEntry)))
+        throw HotStuffError("cannot resize the index: %s", strerror(errno));
+    void *base = mmap(nullptr, cap * sizeof(IndexEntry),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, idx_fd, 0);
+    if (base == MAP_FAILED)
+        throw HotStuffError("cannot map the index: %s", strerror(errno));
+    idx = (IndexEntry *)base;
+    idx_cap = cap;
+}
+
+void BlockLog::add_index(uint32_t height, uint32_t seg, uint64_t offset) {
+    if (idx_size == idx_cap) map_index(idx_cap << 1);
+    idx[idx_size++] = IndexEntry{height, seg, offset};
+    last_indexed = height;
+}
+
+void BlockLog::recover() {
+    struct stat st;
+    while (!stat(seg_path(tail_seg + 1).c_str(), &st)) tail_seg++;
+    open_seg(tail_seg);
+    std::vector<std::pair<uint32_t, uint64_t>> recs;
+    uint64_t valid_end = scan_seg(seg_fd, [&recs](uint32_t height, uint64_t off) {
+        recs.push_back(std::make_pair(height, off));
+    });
+    if (lseek(seg_fd, 0, SEEK_END) != (off_t)valid_end)
+    {
+        HOTSTUFF_LOG_WARN("truncating the torn tail of %s", seg_path(tail_seg).c_str());
+        if (ftruncate(seg_fd, valid_end))
+            throw HotStuffError("cannot truncate the segment: %s", strerror(errno));
+    }
+    tail_offset = valid_end;
+    /* the index could be flushed before the records it points to */
+    while (idx_size &&
+            (idx[idx_size - 1].seg > tail_seg ||
+            (idx[idx_size - 1].seg == tail_seg &&
+            idx[idx_size - 1].offset >= valid_end)))
+        idx[--idx_size] = IndexEntry{0, 0, 0};
+    last_indexed = idx_size ? idx[idx_size - 1].height : 0;
+    for (const auto &r: recs)
+    {
+        if (idx_size && idx[idx_size - 1].seg == tail_seg &&
+            r.second <= idx[idx_size - 1].offset)
+            continue;
+        if (r.second == 0 || r.first >= last_indexed + config.index_interval)
+            add_index(r.first, tail_seg, r.second);
+    }
+    if (!recs.empty())
+        tail_height = recs.back().first;
+    else if (tail_seg > 0)
+    {
+        /* the tail segment was just rolled over */
+        auto path = seg_path(tail_seg - 1);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw HotStuffError("cannot open %s: %s", path.c_str(), strerror(errno));
+        scan_seg(fd, [this](uint32_t height, uint64_t) { tail_height = height; });
+        close(fd);
+    }
+}
+
+void BlockLog::append(uint32_t height, const uint8_t *payload, size_t len) {
+    /* a restarted replica commits again from the genesis */
+    if (height <= tail_height) return;
+    if (len > max_record_size)
+        throw HotStuffError("record of %lu bytes too large", len);
+    uint64_t off = tail_offset + pending.size();
+    if (off == 0 || height >= last_indexed + config.index_interval)
+        add_index(height, tail_seg, off);
+    uint8_t hdr[header_size];
+    put_le32(hdr, len);
+    put_le32(hdr + 4, height);
+    put_le32(hdr + 8, crc32(payload, len));
+    pending.insert(pending.end(), hdr, hdr + header_size);
+    pending.insert(pending.end(), payload, payload + len);
+    tail_height = height;
+}
+
+void BlockLog::flush() {
+    if (pending.empty()) return;
+    size_t done = 0;
+    while (done < pending.size())
+    {
+        ssize_t ret = pwrite(seg_fd, pending.data() + done,
+                            pending.size() - done, tail_offset + done);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            throw HotStuffError("cannot write the block log: %s", strerror(errno));
+        }
+        done += ret;
+    }
+    if (config.sync) fdatasync(seg_fd);
+    tail_offset += pending.size();
+    pending.clear();
+    if (tail_offset >= config.segment_size)
+    {
+        open_seg(tail_seg + 1);
+        tail_offset = 0;
+    }
+}
+
+BlockLog::Iterator BlockLog::read_from(uint32_t height) const {
+    /* the last indexed record not higher than `height` */
+    auto it = std::upper_bound(idx, idx + idx_size, height,
+        [](uint32_t h, const IndexEntry &e) { return h < e.height; });
+    if (it == idx)
+        return Iterator(this, 0, 0, height);
+    --it;
+    return Iterator(this, it->seg, it->offset, height);
+}
+
+BlockLog::Iterator::Iterator(const BlockLog *log, uint32_t seg,
+                            uint64_t offset, uint32_t from_height):
+    log(log), seg(seg), offset(offset), from_height(from_height),
+    fd(-1), seg_size(0), buff_pos(0), buff_offset(offset) {}
+
+BlockLog::Iterator::Iterator(Iterator &&other):
+        log(other.log), seg(other.seg), offset(other.offset),
+        from_height(other.from_height), fd(other.fd),
+        seg_size(other.seg_size),
+        buff(std::move(other.buff)), buff_pos(other.buff_pos),
+        buff_offset(other.buff_offset) {
+    other.fd = -1;
+}
+
+BlockLog::Iterator::~Iterator() {
+    if (fd >= 0) close(fd);
+}
+
+bool BlockLog::Iterator::open_seg() {
+    if (fd >= 0) close(fd);
+    fd = open(log->seg_path(seg).c_str(), O_RDONLY);
+    seg_size = 0;
+    buff.clear();
+    buff_pos = 0;
+    buff_offset = offset;
+    return fd >= 0;
+}
+
+bool BlockLog::Iterator::read(uint8_t *dst, size_t len) {
+    while (len)
+    {
+        if (buff_pos == buff.size())
+        {
+            buff.resize(read_chunk_size);
+            ssize_t n = pread(fd, buff.data(), read_chunk_size, buff_offset);
+            if (n <= 0)
+            {
+                buff.clear();
+                buff_pos = 0;
+                return false;
+            }
+            buff.resize(n);
+            buff_pos = 0;
+            buff_offset += n;
+        }
+        size_t m = std::min(len, buff.size() - buff_pos);
+        memmove(dst, buff.data() + buff_pos, m);
+        buff_pos += m;
+        dst += m;
+        len -= m;
+    }
+    return true;
+}
+
+bool BlockLog::Iterator::has_bytes(uint64_t len) {
+    if (offset + len <= seg_size) return true;
+    /* the tail segment may have grown since */
+    struct stat st;
+    if (fstat(fd, &st) == 0) seg_size = st.st_size;
+    return offset + len <= seg_size;
+}
+
+bool BlockLog::Iterator::next(uint32_t &height, bytearray_t &payload) {
+    for (;;)
+    {
+        if (fd < 0 && !open_seg()) return false;
+        /* a segment before the tail one is never written again */
+        bool sealed = seg < log->tail_seg;
+        if (sealed && !has_bytes(1))
+        {
+            seg++;
+            offset = 0;
+            if (!open_seg()) return false;
+            continue;
+        }
+        uint8_t hdr[header_size];
+        bool ok = has_bytes(header_size) && read(hdr, header_size);
+        if (ok)
+        {
+            /* do not trust the length before checking it */
+            uint32_t len = get_le32(hdr);
+            ok = len <= max_record_size && has_bytes(header_size + len);
+            if (ok)
+            {
+                payload.resize(len);
+                ok = read(payload.data(), len) &&
+                    crc32(payload.data(), len) == get_le32(hdr + 8);
+            }
+        }
+        if (!ok)
+        {
+            if (sealed)
+                throw HotStuffError("corrupted record in %s at offset %lu",
+                                    log->seg_path(seg).c_str(), offset);
+            /* a torn (or not yet flushed) tail: rewind to the record so
+             * it can be retried once flushed */
+            buff.clear();
+            buff_pos = 0;
+            buff_offset = offset;
+            return false;
+        }
+        offset += header_size + payload.size();
+        height = get_le32(hdr + 4);
+        if (height >= from_height) return true;
+    }
+}
+
+BlockLogWriter::BlockLogWriter(const std::string &dir,
+                            const BlockLog::Config &config,
+                            size_t burst_size):
+        log(dir, config) {
+    queue.reg_handler(ec, [this, burst_size](queue_t &q) {
+        size_t cnt = burst_size;
+        std::pair<uint32_t, bytearray_t> e;
+        bool more = false;
+        try {
+            while (q.try_dequeue(e))
+            {
+                log.append(e.first, e.second);
+                if (!--cnt)
+                {
+                    more = true;
+                    break;
+                }
+            }
+            /* one write for the whole batch */
+            log.flush();
+        } catch (std::exception &err) {
+            HOTSTUFF_LOG_ERROR("block log: %s", err.what());
+        }
+        return more;
+    });
+    tcall = new salticidae::ThreadCall(ec);
+    handle = std::thread([this]() { ec.dispatch(); });
+}
+
+BlockLogWriter::~BlockLogWriter() {
+    tcall->async_call([this](salticidae::ThreadCall::Handle &) {
+        ec.stop();
+    });
+    handle.join();
+    std::pair<uint32_t, bytearray_t> e;
+    while (queue.try_dequeue(e))
+        log.append(e.first, e.second);
+}
+
+}
@@ -0,0 +1,97 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include "hotstuff/util.h"
+#include "hotstuff/bloom.h"
+
+namespace hotstuff {
+
+/* the bit positions are derived from two independent 64-bit hashes (double
+ * hashing); the input is already a cryptographic hash, so the second one is
+ * just a mix of the first */
+static inline uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+RotatingBloomFilter::RotatingBloomFilter(size_t capacity, double fp_rate,
+                                        uint32_t window):
+        window(std::max(window, (uint32_t)1)),
+        cur(0), cur_start(0), started(false) {
+    if (!(fp_rate > 0 && fp_rate < 1))
+        throw HotStuffError("invalid false positive rate");
+    const double ln2 = std::log(2);
+    capacity = std::max(capacity, (size_t)1);
+    /* the optimal size and number of hash functions */
+    double m = -(double)capacity * std::log(fp_rate) / (ln2 * ln2);
+    nbits = std::max((size_t)std::ceil(m / 64), (size_t)1) * 64;
+    nhashes = std::max((uint32_t)std::round(nbits / (double)capacity * ln2), (uint32_t)1);
+    for (auto &g: gens) g.assign(nbits / 64, 0);
+}
+
+void RotatingBloomFilter::rotate(uint32_t height) {
+    cur ^= 1;
+    std::fill(gens[cur].begin(), gens[cur].end(), 0);
+    cur_start = height;
+}
+
+void RotatingBloomFilter::insert(const uint256_t &hash, uint32_t height) {
+    if (!started)
+    {
+        started = true;
+        cur_start = height;
+    }
+    else if (height >= cur_start + window)
+        rotate(height);
+    uint64_t h1 = std::hash<uint256_t>()(hash);
+    uint64_t h2 = mix64(h1) | 1;
+    auto &bits = gens[cur];
+    for (uint32_t i = 0; i < nhashes; i++)
+    {
+        size_t pos = (h1 + i * h2) % nbits;
+        bits[pos >> 6] |= (uint64_t)1 << (pos & 63);
+    }
+}
+
+bool RotatingBloomFilter::contains(const uint256_t &hash) const {
+    uint64_t h1 = std::hash<uint256_t>()(hash);
+    uint64_t h2 = mix64(h1) | 1;
+    for (const auto &bits: gens)
+    {
+        uint32_t i;
+        for (i = 0; i < nhashes; i++)
+        {
+            size_t pos = (h1 + i * h2) % nbits;
+            if (!(bits[pos >> 6] & ((uint64_t)1 << (pos & 63)))) break;
+        }
+        if (i == nhashes) return true;
+    }
+    return false;
+}
+
+void RotatingBloomFilter::clear() {
+    for (auto &g: gens) std::fill(g.begin(), g.end(), 0);
+    started = false;
+}
+
+}
@@ -14,14 +14,265 @@
  * limitations under the License.
  */
 
+#include "hotstuff/util.h"
 #include "hotstuff/client.h"
 
 namespace hotstuff {
 
+using salticidae::_1;
+using salticidae::_2;
+
 const opcode_t MsgReqCmd::opcode;
 const opcode_t MsgRespCmd::opcode;
+const opcode_t MsgRespProof::opcode;
+const opcode_t MsgReqCmdBatch::opcode;
+const opcode_t MsgRespCmdBatch::opcode;
+const opcode_t MsgReqRead::opcode;
+const opcode_t MsgRespRead::opcode;
 //#ifdef HOTSTUFF_AUTOCLI
 //const opcode_t MsgDemandCmd::opcode;
 //#endif
 
+HotStuffClient::HotStuffClient(const std::vector<NetAddr> &replicas,
+                                const Config &config):
+        config(config),
+        replicas(replicas),
+        nfaulty((replicas.size() - 1) / 3),
+        net(ec, config.net_config),
+        conns(replicas.size()),
+        connecting(replicas.size()),
+        use_proof(false), proof_idx(0) {
+    if (replicas.empty())
+        throw HotStuffError("no replica to connect");
+    queue.reg_handler(ec, [this](queue_t &q) {
+        Submission sub;
+        while (q.try_dequeue(sub))
+            on_submit(std::move(sub));
+        flush_batch();
+        return false;
+    });
+    net.reg_handler(salticidae::generic_bind(&HotStuffClient::resp_cmd_handler, this, _1, _2));
+    net.reg_handler(salticidae::generic_bind(&HotStuffClient::resp_cmd_batch_handler, this, _1, _2));
+    net.reg_handler(salticidae::generic_bind(&HotStuffClient::resp_proof_handler, this, _1, _2));
+    net.reg_conn_handler([this](const salticidae::ConnPool::conn_t &_conn, bool connected) {
+        auto conn = salticidae::static_pointer_cast<Net::conn_t::type>(_conn);
+        auto it = conn_rid.find(conn);
+        if (it == conn_rid.end()) return true;
+        ReplicaID rid = it->second;
+        if (connected)
+        {
+            conns[rid] = conn;
+            /* catch the replica up with the commands sent without it */
+            for (auto &p: inflight)
+                if (!p.second.sent_to[rid]) send_cmd(p.second, rid);
+        }
+        else
+        {
+            HOTSTUFF_LOG_WARN("lost replica %u", (unsigned)rid);
+            /* reconnected upon the next tick */
+            conns[rid] = nullptr;
+            connecting[rid] = false;
+            conn_rid.erase(it);
+        }
+        return true;
+    });
+    tick_timer = TimerEvent(ec, [this](TimerEvent &) {
+        on_tick();
+        tick_timer.add(this->config.timeout / 4);
+    });
+}
+
+HotStuffClient::~HotStuffClient() {
+    if (!tcall) return;
+    tcall->async_call([this](salticidae::ThreadCall::Handle &) {
+        ec.stop();
+    });
+    handle.join();
+}
+
+void HotStuffClient::start() {
+    net.start();
+    for (ReplicaID rid = 0; rid < replicas.size(); rid++)
+        connect(rid);
+    tick_timer.add(config.timeout / 4);
+    tcall = new salticidae::ThreadCall(ec);
+    handle = std::thread([this]() { ec.dispatch(); });
+}
+
+void HotStuffClient::connect(ReplicaID rid) {
+    connecting[rid] = true;
+    conn_rid[net.connect(replicas[rid])] = rid;
+}
+
+void HotStuffClient::on_submit(Submission &&sub) {
+    const uint256_t &cmd_hash = sub.cmd->get_hash();
+    auto it = inflight.find(cmd_hash);
+    if (it != inflight.end())
+    {
+        /* the same command waits for the same decision */
+        it->second.callbacks.push_back(std::move(sub.callback));
+        return;
+    }
+    if (inflight.size() >= config.max_inflight)
+    {
+        pending.push_back(std::move(sub));
+        return;
+    }
+    auto &req = inflight[cmd_hash];
+    req.cmd = std::move(sub.cmd);
+    req.callbacks.push_back(std::move(sub.callback));
+    req.retries = 0;
+    req.et.start();
+    req.sent = 0;
+    req.sent_to.resize(replicas.size());
+    /* the proofs are asked from one replica only */
+    if (config.max_batch > 1 && !use_proof)
+    {
+        batch.push_back(req.cmd);
+        if (batch.size() >= config.max_batch) flush_batch();
+    }
+    else
+        broadcast_cmd(req);
+}
+
+uint8_t HotStuffClient::get_resp_mode(const Request &req, ReplicaID rid) const {
+    /* the retries fall back to the acknowledgements */
+    if (!use_proof || req.retries) return MsgReqCmd::RESP_ACK;
+    /* every replica still needs the command to propose it */
+    return rid == proof_idx ? MsgReqCmd::RESP_PROOF : MsgReqCmd::RESP_NONE;
+}
+
+void HotStuffClient::send_cmd(Request &req, ReplicaID rid) {
+    if (conns[rid] == nullptr) return;
+    net.send_msg(MsgReqCmd(*req.cmd, get_resp_mode(req, rid)), conns[rid]);
+    req.sent_to[rid] = true;
+}
+
+void HotStuffClient::broadcast_cmd(Request &req) {
+    /* serialized once for the replicas other than the one asked for the
+     * proof */
+    MsgReqCmd msg(*req.cmd, get_resp_mode(req, replicas.size()));
+    for (ReplicaID rid = 0; rid < replicas.size(); rid++)
+    {
+        if (conns[rid] == nullptr) continue;
+        if (use_proof && req.retries == 0 && rid == proof_idx)
+            send_cmd(req, rid);
+        else
+        {
+            net.send_msg(msg, conns[rid]);
+            req.sent_to[rid] = true;
+        }
+    }
+}
+
+void HotStuffClient::flush_batch() {
+    if (batch.empty()) return;
+    MsgReqCmdBatch msg(batch.begin(), batch.end());
+    for (ReplicaID rid = 0; rid < replicas.size(); rid++)
+    {
+        if (conns[rid] == nullptr) continue;
+        net.send_msg(msg, conns[rid]);
+        for (const auto &cmd: batch)
+        {
+            auto it = inflight.find(cmd->get_hash());
+            if (it != inflight.end()) it->second.sent_to[rid] = true;
+        }
+    }
+    batch.clear();
+}
+
+void HotStuffClient::on_tick() {
+    for (ReplicaID rid = 0; rid < replicas.size(); rid++)
+        if (!connecting[rid]) connect(rid);
+    std::vector<uint256_t> expired;
+    for (auto &p: inflight)
+    {
+        auto &req = p.second;
+        req.et.stop();
+        if (req.et.elapsed_sec - req.sent < config.timeout) continue;
+        if (req.retries >= config.max_retries)
+        {
+            expired.push_back(p.first);
+            continue;
+        }
+        req.retries++;
+        req.sent = req.et.elapsed_sec;
+        HOTSTUFF_LOG_DEBUG("resending cmd %.10s", get_hex(p.first).c_str());
+        broadcast_cmd(req);
+    }
+    /* finished after the scan, as the freed slots are refilled */
+    for (const auto &cmd_hash: expired)
+    {
+        auto it = inflight.find(cmd_hash);
+        if (it != inflight.end())
+            finish(it, CmdResult::TIMEOUT,
+                    Finality(-1, 0, 0, 0, cmd_hash, uint256_t()));
+    }
+}
+
+void HotStuffClient::finish(std::unordered_map<const uint256_t, Request>::iterator it,
+                            CmdResult::Status status, const Finality &fin) {
+    auto &req = it->second;
+    req.et.stop();
+    CmdResult res(status, fin, req.et.elapsed_sec);
+    auto callbacks = std::move(req.callbacks);
+    inflight.erase(it);
+    for (auto &cb: callbacks) cb(res);
+    /* fill the freed slots */
+    while (!pending.empty() && inflight.size() < config.max_inflight)
+    {
+        auto sub = std::move(pending.front());
+        pending.pop_front();
+        on_submit(std::move(sub));
+    }
+    flush_batch();
+}
+
+void HotStuffClient::resp_cmd_handler(MsgRespCmd &&msg, const Net::conn_t &conn) {
+    auto it = conn_rid.find(conn);
+    /* the replica is identified by the connection, not by its claim */
+    if (it != conn_rid.end()) on_resp(msg.fin, it->second);
+}
+
+void HotStuffClient::resp_cmd_batch_handler(MsgRespCmdBatch &&msg, const Net::conn_t &conn) {
+    auto it = conn_rid.find(conn);
+    if (it == conn_rid.end()) return;
+    for (const auto &fin: msg.fins) on_resp(fin, it->second);
+}
+
+void HotStuffClient::on_resp(const Finality &fin, ReplicaID rid) {
+    auto it = inflight.find(fin.cmd_hash);
+    if (it == inflight.end()) return;
+    auto &req = it->second;
+    req.resps[rid] = fin;
+    /* a retry could be rejected by a replica still waiting for the first
+     * attempt, so the rejections only count before retrying (which also
+     * ignores those of a retry found committed, see the class comment) */
+    if (fin.decision != 1 && req.retries) return;
+    size_t nmatch = 0;
+    for (const auto &p: req.resps)
+    {
+        const auto &f = p.second;
+        if (f.decision == fin.decision &&
+            (fin.decision != 1 ||
+             (f.blk_hash == fin.blk_hash && f.cmd_idx == fin.cmd_idx)))
+            nmatch++;
+    }
+    /* wait for f + 1 matching decisions */
+    if (nmatch <= nfaulty) return;
+    finish(it, fin.decision == 1 ? CmdResult::COMMITTED : CmdResult::REJECTED, fin);
+}
+
+void HotStuffClient::resp_proof_handler(MsgRespProof &&msg, const Net::conn_t &) {
+    const auto &fin = msg.fin;
+    auto it = inflight.find(fin.cmd_hash);
+    if (it == inflight.end() || !use_proof) return;
+    if (!msg.proof.verify(fin, replica_config, parse_qc))
+    {
+        HOTSTUFF_LOG_WARN("invalid commit proof for %s", std::string(fin).c_str());
+        return;
+    }
+    finish(it, CmdResult::COMMITTED, fin);
+}
+
 }
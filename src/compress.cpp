@@ -0,0 +1,98 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hotstuff/util.h"
+#include "hotstuff/compress.h"
+
+#ifdef HOTSTUFF_COMPRESSION
+#include <zstd.h>
+
+namespace hotstuff {
+
+Compressor::Compressor(int level, const bytearray_t &dict):
+        cctx(ZSTD_createCCtx()), dctx(ZSTD_createDCtx()),
+        cdict(nullptr), ddict(nullptr), level(level) {
+    if (!dict.empty())
+    {
+        cdict = ZSTD_createCDict(dict.data(), dict.size(), level);
+        ddict = ZSTD_createDDict(dict.data(), dict.size());
+        dict_hash = salticidae::get_hash(dict);
+    }
+}
+
+bool Compressor::is_supported() { return true; }
+
+Compressor::~Compressor() {
+    ZSTD_freeCCtx(static_cast<ZSTD_CCtx *>(cctx));
+    ZSTD_freeDCtx(static_cast<ZSTD_DCtx *>(dctx));
+    if (cdict) ZSTD_freeCDict(static_cast<ZSTD_CDict *>(cdict));
+    if (ddict) ZSTD_freeDDict(static_cast<ZSTD_DDict *>(ddict));
+}
+
+bool Compressor::compress(const uint8_t *data, size_t size, bytearray_t &out) {
+    out.resize(ZSTD_compressBound(size));
+    auto c = static_cast<ZSTD_CCtx *>(cctx);
+    size_t ret = cdict ?
+        ZSTD_compress_usingCDict(c, out.data(), out.size(), data, size,
+                                static_cast<ZSTD_CDict *>(cdict)) :
+        ZSTD_compressCCtx(c, out.data(), out.size(), data, size, level);
+    if (ZSTD_isError(ret) || ret >= size) return false;
+    out.resize(ret);
+    return true;
+}
+
+void Compressor::decompress(const uint8_t *data, size_t size, size_t raw_size,
+                            bytearray_t &out) {
+    if (raw_size > max_decompressed_size)
+        throw HotStuffError("decompressed size %lu too large", raw_size);
+    unsigned dict_id = ZSTD_getDictID_fromFrame(data, size);
+    if (dict_id && (!ddict || dict_id !=
+            ZSTD_getDictID_fromDDict(static_cast<ZSTD_DDict *>(ddict))))
+        throw HotStuffError("compressed with an unknown dictionary %u", dict_id);
+    out.resize(raw_size);
+    auto d = static_cast<ZSTD_DCtx *>(dctx);
+    size_t ret = ddict ?
+        ZSTD_decompress_usingDDict(d, out.data(), raw_size, data, size,
+                                static_cast<ZSTD_DDict *>(ddict)) :
+        ZSTD_decompressDCtx(d, out.data(), raw_size, data, size);
+    if (ZSTD_isError(ret))
+        throw HotStuffError("decompression failed: %s", ZSTD_getErrorName(ret));
+    if (ret != raw_size)
+        throw HotStuffError("decompressed size mismatch");
+}
+
+}
+
+#else
+
+namespace hotstuff {
+
+Compressor::Compressor(int, const bytearray_t &) {
+    throw HotStuffError("not built with compression (HOTSTUFF_COMPRESSION)");
+}
+
+Compressor::~Compressor() {}
+
+bool Compressor::is_supported() { return false; }
+
+bool Compressor::compress(const uint8_t *, size_t, bytearray_t &) { return false; }
+
+void Compressor::decompress(const uint8_t *, size_t, size_t, bytearray_t &) {}
+
+}
+
+#endif
@@ -17,6 +17,7 @@
 
 #include <cassert>
 #include <stack>
+#include <algorithm>
 
 #include "hotstuff/util.h"
 #include "hotstuff/consensus.h"
@@ -28,6 +29,11 @@
 
 namespace hotstuff {
 
+static const uint32_t snapshot_magic = 0x48535332; /* "HSS2" */
+/* the checkpoints voted more than this many periods above b_exec are
+ * ignored */
+static const uint32_t ckpt_max_ahead = 2;
+
 /* The core logic of HotStuff, is fairly simple :). */
 /*** begin HotStuff protocol logic ***/
 HotStuffCore::HotStuffCore(ReplicaID id,
@@ -36,9 +42,14 @@ HotStuffCore::HotStuffCore(ReplicaID id,
         b_lock(b0),
         b_exec(b0),
         vheight(0),
+        lock_floor(0),
         priv_key(std::move(priv_key)),
         tails{b0},
         vote_disabled(false),
+        prune_staleness(0),
+        npruned(0),
+        ckpt_period(0),
+        stable_ckpt(Checkpoint(0, b0->get_hash(), uint256_t()), nullptr),
         id(id),
         storage(new EntityStorage()) {
     storage->add_blk(b0);
@@ -112,6 +123,7 @@ void HotStuffCore::update(const block_t &nblk) {
 
     /* commit requires direct parent */
     if (blk2->parents[0] != blk1 || blk1->parents[0] != blk) return;
+    commit_proof.first = {blk1, blk2};
 #else
     /* two-step HotStuff */
     const block_t &blk1 = nblk->qc_ref;
@@ -126,8 +138,14 @@ void HotStuffCore::update(const block_t &nblk) {
 
     /* commit requires direct parent */
     if (blk1->parents[0] != blk) return;
+    commit_proof.first = {blk1};
 #endif
     /* otherwise commit */
+    commit_proof.second = nblk->qc->clone();
+    commit(blk);
+}
+
+void HotStuffCore::commit(const block_t &blk) {
     std::vector<block_t> commit_queue;
     block_t b;
     for (b = blk; b->height > b_exec->height; b = b->parents[0])
@@ -138,17 +156,70 @@ void HotStuffCore::update(const block_t &nblk) {
         throw std::runtime_error("safety breached :( " +
                                 std::string(*blk) + " " +
                                 std::string(*b_exec));
+    commit_pending = nullptr;
     for (auto it = commit_queue.rbegin(); it != commit_queue.rend(); it++)
     {
         const block_t &blk = *it;
+        if (!blk->has_body())
+        {
+            /* resumed by on_receive_body() */
+            LOG_PROTO("waiting for the body of %s", std::string(*blk).c_str());
+            commit_pending = commit_queue[0];
+            break;
+        }
         blk->decision = 1;
+        if (prune_staleness) prune_window.push(blk);
         do_consensus(blk);
         LOG_PROTO("commit %s", std::string(*blk).c_str());
-        for (size_t i = 0; i < blk->cmds.size(); i++)
-            do_decide(Finality(id, 1, i, blk->height,
-                                blk->cmds[i], blk->get_hash()));
+        do_decide(BlockFinality(id, blk->height, blk->get_hash(), blk->cmds));
+        if (ckpt_period && blk->height % ckpt_period == 0)
+            on_checkpoint(blk);
+        b_exec = blk;
     }
-    b_exec = blk;
+    schedule_prune();
+}
+
+void HotStuffCore::on_receive_committed(const block_t &blk) {
+    if (blk->height <= b_exec->height) return;
+    LOG_PROTO("learned %s", std::string(*blk).c_str());
+    commit(blk);
+}
+
+void HotStuffCore::on_receive_body(const block_t &blk) {
+    if (commit_pending && blk->height <= commit_pending->height &&
+        blk->height > b_exec->height)
+        commit(commit_pending);
+}
+
+bool HotStuffCore::prove_commit(const Finality &fin, CommitProof &proof) const {
+    if (fin.decision != 1 || !commit_proof.second) return false;
+    block_t blk = storage->find_blk(fin.blk_hash);
+    if (!blk || !blk->decision) return false;
+    std::vector<block_t> chain(commit_proof.first.rbegin(), commit_proof.first.rend());
+    block_t b;
+    for (b = chain.back()->parents[0]; b->height > blk->height; b = b->parents[0])
+    {
+        chain.push_back(b);
+        /* pruned */
+        if (b->parents.empty()) return false;
+    }
+    if (b != blk) return false;
+    chain.push_back(blk);
+    /* the commands of a block are usually proven one after another */
+    if (cmd_tree_cache.first != blk->get_hash())
+        cmd_tree_cache = std::make_pair(blk->get_hash(), blk->get_cmd_tree());
+    proof.cmd_proof = cmd_tree_cache.second.prove(fin.cmd_idx);
+    proof.blks.clear();
+    for (auto it = chain.rbegin(); it != chain.rend(); it++)
+    {
+        DataStream s;
+        (*it)->serialize_header(s);
+        proof.blks.push_back(std::move(s));
+    }
+    DataStream s;
+    s << *commit_proof.second;
+    proof.qc = std::move(s);
+    return true;
 }
 
 block_t HotStuffCore::on_propose(const std::vector<uint256_t> &cmds,
@@ -175,9 +246,11 @@ block_t HotStuffCore::on_propose(const std::vector<uint256_t> &cmds,
     if (bnew->height <= vheight)
         throw std::runtime_error("new block should be higher than vheight");
     vheight = bnew->height;
-    on_receive_vote(
-        Vote(id, bnew_hash,
-            create_part_cert(*priv_key, bnew_hash), this));
+    if (!do_persist_vote(vheight, b_lock))
+        throw std::runtime_error("failed to persist the vote state");
+    async_create_part_cert(*priv_key, bnew_hash).then([this, bnew_hash](PartCert *pc) {
+        on_receive_vote(Vote(id, bnew_hash, pc, this));
+    });
     on_propose_(prop);
     /* boradcast to other replicas */
     do_broadcast_proposal(prop);
@@ -192,12 +265,13 @@ void HotStuffCore::on_receive_proposal(const Proposal &prop) {
     bool opinion = false;
     if (bnew->height > vheight)
     {
-        if (bnew->qc_ref && bnew->qc_ref->height > b_lock->height)
+        if (bnew->qc_ref &&
+            bnew->qc_ref->height > std::max(b_lock->height, lock_floor))
         {
             opinion = true; // liveness condition
             vheight = bnew->height;
         }
-        else
+        else if (b_lock->height >= lock_floor)
         {   // safety condition (extend the locked branch)
             block_t b;
             for (b = bnew;
@@ -214,10 +288,22 @@ void HotStuffCore::on_receive_proposal(const Proposal &prop) {
     if (bnew->qc_ref)
         on_qc_finish(bnew->qc_ref);
     on_receive_proposal_(prop);
+    if (opinion && !vote_disabled &&
+        !do_persist_vote(vheight, b_lock))
+    {
+        LOG_WARN("vote withheld: failed to persist the vote state");
+        opinion = false;
+    }
     if (opinion && !vote_disabled)
-        do_vote(prop.proposer,
-            Vote(id, bnew->get_hash(),
-                create_part_cert(*priv_key, bnew->get_hash()), this));
+    {
+        /* the vote is sent once signed, which may happen on another thread */
+        const uint256_t bnew_hash = bnew->get_hash();
+        ReplicaID proposer = prop.proposer;
+        async_create_part_cert(*priv_key, bnew_hash).then(
+                [this, proposer, bnew_hash](PartCert *pc) {
+            do_vote(proposer, Vote(id, bnew_hash, pc, this));
+        });
+    }
 }
 
 void HotStuffCore::on_receive_vote(const Vote &vote) {
@@ -256,27 +342,331 @@ void HotStuffCore::on_init(uint32_t nfaulty) {
     hqc = std::make_pair(b0, b0->qc->clone());
 }
 
+bool HotStuffCore::save_snapshot(DataStream &s) const {
+    /* collect the blocks not lower than b_exec */
+    std::vector<block_t> blks;
+    std::unordered_set<block_t> visited;
+    std::stack<block_t> st;
+    for (const auto &t: tails) st.push(t);
+    while (!st.empty())
+    {
+        block_t blk = st.top();
+        st.pop();
+        if (blk->height < b_exec->height || !visited.insert(blk).second)
+            continue;
+        blks.push_back(blk);
+        for (const auto &p: blk->parents) st.push(p);
+    }
+    std::sort(blks.begin(), blks.end(), BlockHeightCmp());
+    /* only keep those extending b_exec */
+    std::unordered_set<block_t> live{b_exec};
+    std::vector<block_t> live_blks;
+    for (const auto &blk: blks)
+    {
+        if (blk != b_exec &&
+            (blk->parents.empty() || !live.count(blk->parents[0])))
+            continue;
+        if (!blk->has_body()) return false;
+        live.insert(blk);
+        if (blk != b0) live_blks.push_back(blk);
+    }
+    s << snapshot_magic << vheight;
+    s << (uint32_t)live_blks.size();
+    for (const auto &blk: live_blks)
+        s << blk->height << blk->decision << *blk;
+    s << b_exec->get_hash() << b_lock->get_hash()
+      << hqc.first->get_hash() << *hqc.second;
+    uint32_t ntails = 0;
+    for (const auto &t: tails) if (live.count(t)) ntails++;
+    s << ntails;
+    for (const auto &t: tails)
+        if (live.count(t)) s << t->get_hash();
+    if (stable_ckpt.second)
+        s << (uint8_t)1 << stable_ckpt.first << *stable_ckpt.second;
+    else
+        s << (uint8_t)0;
+    do_save_snapshot(s);
+    return true;
+}
+
+void HotStuffCore::load_snapshot(DataStream &s) {
+    uint32_t magic, _vheight, n;
+    s >> magic;
+    if (magic != snapshot_magic)
+        throw std::runtime_error("invalid snapshot");
+    /* parse everything before touching the state */
+    s >> _vheight >> n;
+    std::vector<Block> blks;
+    std::vector<std::pair<uint32_t, int8_t>> metas;
+    std::unordered_set<uint256_t> known;
+    while (n--)
+    {
+        uint32_t height;
+        int8_t decision;
+        s >> height >> decision;
+        blks.emplace_back();
+        blks.back().unserialize(s, this);
+        metas.push_back(std::make_pair(height, decision));
+        known.insert(blks.back().get_hash());
+    }
+    uint256_t exec_hash, lock_hash, hqc_hash;
+    s >> exec_hash >> lock_hash >> hqc_hash;
+    quorum_cert_bt hqc_qc = parse_quorum_cert(s);
+    std::vector<uint256_t> tail_hashes{exec_hash, lock_hash, hqc_hash};
+    s >> n;
+    while (n--)
+    {
+        uint256_t hash;
+        s >> hash;
+        tail_hashes.push_back(hash);
+    }
+    for (const auto &hash: tail_hashes)
+        if (!known.count(hash) && !storage->is_blk_delivered(hash))
+            throw std::runtime_error("block missing from the snapshot");
+    uint8_t flag;
+    s >> flag;
+    std::pair<Checkpoint, quorum_cert_bt> _ckpt(stable_ckpt.first, nullptr);
+    if (flag)
+    {
+        s >> _ckpt.first;
+        _ckpt.second = parse_quorum_cert(s);
+    }
+    /* the state of the user comes last */
+    do_load_snapshot(s);
+    /* all parsed, now switch to the restored state */
+    for (size_t i = 0; i < blks.size(); i++)
+    {
+        block_t blk = storage->add_blk(std::move(blks[i]), config);
+        if (blk->delivered) continue;
+        blk->height = metas[i].first;
+        blk->decision = metas[i].second;
+        blk->parents.clear();
+        /* the base of the snapshot has its ancestors pruned, while the
+         * other blocks may only miss their (pruned) uncles */
+        block_t p0;
+        if (!blk->parent_hashes.empty())
+            p0 = storage->find_blk(blk->parent_hashes[0]);
+        if (p0 != nullptr && p0->delivered)
+            for (const auto &hash: blk->parent_hashes)
+            {
+                block_t p = storage->find_blk(hash);
+                if (p != nullptr && p->delivered)
+                    blk->parents.push_back(std::move(p));
+            }
+        if (blk->qc)
+            blk->qc_ref = storage->find_blk(blk->qc->get_obj_hash());
+        blk->delivered = true;
+    }
+    vheight = _vheight;
+    b_exec = get_delivered_blk(exec_hash);
+    b_lock = get_delivered_blk(lock_hash);
+    hqc = std::make_pair(get_delivered_blk(hqc_hash), std::move(hqc_qc));
+    tails.clear();
+    for (size_t i = 3; i < tail_hashes.size(); i++)
+        tails.insert(get_delivered_blk(tail_hashes[i]));
+    if (_ckpt.second) stable_ckpt = std::move(_ckpt);
+    LOG_INFO("restored from snapshot: %s", std::string(*this).c_str());
+}
+
+void HotStuffCore::restore_vote_state(uint32_t _vheight,
+                                    const uint256_t &lock_hash,
+                                    uint32_t lock_height) {
+    if (_vheight > vheight) vheight = _vheight;
+    if (lock_height > b_lock->height)
+    {
+        block_t blk = storage->find_blk(lock_hash);
+        if (blk && blk->delivered)
+            b_lock = blk;
+        else
+        {
+            /* the branch of the lock cannot be checked without its block */
+            lock_floor = lock_height;
+            LOG_WARN("the recorded lock %s is unknown",
+                    get_hex10(lock_hash).c_str());
+        }
+    }
+    LOG_INFO("restored the vote state: %s", std::string(*this).c_str());
+}
+
 void HotStuffCore::prune(uint32_t staleness) {
     block_t start;
     /* skip the blocks */
     for (start = b_exec; staleness; staleness--, start = start->parents[0])
         if (!start->parents.size()) return;
-    std::stack<block_t> s;
     start->qc_ref = nullptr;
-    s.push(start);
-    while (!s.empty())
+    prune_stack.push(start);
+    prune_step(0);
+}
+
+void HotStuffCore::schedule_prune() {
+    if (!prune_staleness) return;
+    /* the committed chain below the oldest block in the window is stale,
+     * unless it is not yet covered by a certified checkpoint */
+    while (prune_window.size() > prune_staleness &&
+            (!ckpt_period ||
+            prune_window.front()->height <= stable_ckpt.first.height))
+    {
+        block_t start = std::move(prune_window.front());
+        prune_window.pop();
+        if (start->parents.empty()) continue;
+        start->qc_ref = nullptr;
+        prune_stack.push(std::move(start));
+    }
+    /* tails not higher than b_exec can never be committed (they stay in
+     * tails until released, see prune_step()) */
+    for (const auto &t: tails)
+        if (t->height <= b_exec->height && t != b_exec)
+            prune_forks.insert(t);
+    /* a committed block is certified, while a dead fork never will be */
+    std::vector<std::pair<block_t, promise_t>> stale;
+    for (auto it = qc_waiting.begin(); it != qc_waiting.end();)
+    {
+        if (it->first->height > b_exec->height)
+        {
+            it++;
+            continue;
+        }
+        stale.push_back(std::move(*it));
+        it = qc_waiting.erase(it);
+    }
+    for (auto &e: stale)
+    {
+        if (e.first->decision == 1) e.second.resolve();
+        else e.second.reject();
+    }
+    if (get_prune_pending()) do_prune();
+}
+
+void HotStuffCore::release_fork(block_t blk) {
+    /* walk down the branch until reaching a committed block or a block that
+     * is still referred by others (e.g. a sibling branch) */
+    while (blk != nullptr && blk->decision != 1 && blk.get_cnt() == 2)
+    {
+        block_t next = nullptr;
+        if (!blk->parents.empty()) next = blk->parents[0];
+        blk->parents.clear();
+        blk->qc_ref = nullptr;
+        if (storage->try_release_blk(blk)) npruned++;
+        blk = std::move(next);
+    }
+}
+
+bool HotStuffCore::prune_step(double budget) {
+    salticidae::ElapsedTime elapsed;
+    elapsed.start();
+    for (size_t cnt = 0;; cnt++)
     {
-        auto &blk = s.top();
+        /* checking the clock for every block is too costly */
+        if (budget > 0 && !(cnt & 0x3f))
+        {
+            elapsed.stop(false);
+            if (elapsed.elapsed_sec >= budget) break;
+        }
+        if (!prune_forks.empty())
+        {
+            block_t blk = *prune_forks.begin();
+            prune_forks.erase(prune_forks.begin());
+            /* extended meanwhile */
+            if (!tails.erase(blk)) continue;
+            /* still referred by others (e.g., a pending delivery), so it is
+             * kept as a tail to be tried again upon a later commit */
+            if (blk.get_cnt() != 2)
+            {
+                tails.insert(std::move(blk));
+                continue;
+            }
+            release_fork(std::move(blk));
+            continue;
+        }
+        if (prune_stack.empty()) break;
+        auto &blk = prune_stack.top();
         if (blk->parents.empty())
         {
-            storage->try_release_blk(blk);
-            s.pop();
+            if (storage->try_release_blk(blk)) npruned++;
+            prune_stack.pop();
             continue;
         }
         blk->qc_ref = nullptr;
-        s.push(blk->parents.back());
+        prune_stack.push(blk->parents.back());
         blk->parents.pop_back();
     }
+    return get_prune_pending() > 0;
+}
+
+void HotStuffCore::on_checkpoint(const block_t &blk) {
+    Checkpoint ckpt(blk->height, blk->get_hash(), do_state_digest());
+    const uint256_t ckpt_hash = ckpt.get_hash();
+    LOG_PROTO("checkpoint %s", std::string(ckpt).c_str());
+    async_create_part_cert(*priv_key, ckpt_hash).then([this, ckpt](PartCert *pc) {
+        CheckpointVote vote(id, ckpt, pc, this);
+        on_receive_checkpoint(vote);
+        do_broadcast_checkpoint(vote);
+    });
+}
+
+void HotStuffCore::on_receive_checkpoint(const CheckpointVote &vote) {
+    LOG_PROTO("got %s", std::string(vote).c_str());
+    const auto &ckpt = vote.ckpt;
+    if (!ckpt_period || ckpt.height % ckpt_period ||
+        ckpt.height <= stable_ckpt.first.height) return;
+    if (ckpt.height > b_exec->height + ckpt_max_ahead * ckpt_period)
+    {
+        LOG_WARN("checkpoint vote for height %u from %d too far ahead",
+                ckpt.height, vote.voter);
+        return;
+    }
+    assert(vote.cert);
+    const uint256_t ckpt_hash = ckpt.get_hash();
+    /* keep at most one pending checkpoint per voter */
+    auto vit = ckpt_voted.find(vote.voter);
+    if (vit != ckpt_voted.end() && vit->second != ckpt_hash)
+    {
+        auto old = ckpt_waiting.find(vit->second);
+        if (old != ckpt_waiting.end())
+        {
+            if (old->second.ckpt.height >= ckpt.height)
+            {
+                LOG_WARN("checkpoint vote for %s from %d not above its pending one",
+                        get_hex10(ckpt_hash).c_str(), vote.voter);
+                return;
+            }
+            /* superseded, as a replica votes for increasing heights */
+            old->second.voted.erase(vote.voter);
+            if (old->second.voted.empty()) ckpt_waiting.erase(old);
+        }
+    }
+    auto it = ckpt_waiting.find(ckpt_hash);
+    if (it == ckpt_waiting.end())
+        it = ckpt_waiting.insert(std::make_pair(ckpt_hash,
+                CheckpointContext(ckpt, create_quorum_cert(ckpt_hash)))).first;
+    auto &ctx = it->second;
+    if (!ctx.voted.insert(vote.voter).second)
+    {
+        LOG_WARN("duplicate checkpoint vote for %s from %d",
+                get_hex10(ckpt_hash).c_str(), vote.voter);
+        return;
+    }
+    ctx.qc->add_part(vote.voter, *vote.cert);
+    ckpt_voted[vote.voter] = ckpt_hash;
+    if (ctx.voted.size() < config.nmajority) return;
+    ctx.qc->compute();
+    stable_ckpt = std::make_pair(ctx.ckpt, std::move(ctx.qc));
+    LOG_PROTO("certified %s", std::string(stable_ckpt.first).c_str());
+    /* votes for the older checkpoints are no longer useful */
+    for (auto it = ckpt_waiting.begin(); it != ckpt_waiting.end();)
+    {
+        if (it->second.ckpt.height <= stable_ckpt.first.height)
+            it = ckpt_waiting.erase(it);
+        else it++;
+    }
+    for (auto it = ckpt_voted.begin(); it != ckpt_voted.end();)
+    {
+        if (!ckpt_waiting.count(it->second))
+            it = ckpt_voted.erase(it);
+        else it++;
+    }
+    do_checkpoint(stable_ckpt.first, *stable_ckpt.second);
+    schedule_prune();
 }
 
 void HotStuffCore::add_replica(ReplicaID rid, const NetAddr &addr,
@@ -350,8 +740,98 @@ HotStuffCore::operator std::string () const {
       << "b_lock=" << get_hex10(b_lock->get_hash()) << " "
       << "b_exec=" << get_hex10(b_exec->get_hash()) << " "
       << "vheight=" << std::to_string(vheight) << " "
+      << "ckpt=" << std::to_string(stable_ckpt.first.height) << " "
       << "tails=" << std::to_string(tails.size()) << ">";
     return std::move(s);
 }
 
+void CommitProof::serialize(DataStream &s) const {
+    s << cmd_proof << htole((uint32_t)blks.size());
+    for (const auto &blk: blks)
+        s << htole((uint32_t)blk.size()) << blk;
+    s << htole((uint32_t)qc.size()) << qc;
+}
+
+void CommitProof::unserialize(DataStream &s) {
+    uint32_t n;
+    s >> cmd_proof >> n;
+    blks.resize(letoh(n));
+    for (auto &blk: blks)
+    {
+        s >> n;
+        n = letoh(n);
+        auto base = s.get_data_inplace(n);
+        blk = bytearray_t(base, base + n);
+    }
+    s >> n;
+    n = letoh(n);
+    auto base = s.get_data_inplace(n);
+    qc = bytearray_t(base, base + n);
+}
+
+bool CommitProof::verify(const Finality &fin, const ReplicaConfig &config,
+            const std::function<quorum_cert_bt(DataStream &)> &parse_qc) const {
+    if (fin.decision != 1 || cmd_proof.index != fin.cmd_idx ||
+        blks.size() <= commit_depth)
+        return false;
+    try {
+        std::vector<BlockLink> chain(blks.size());
+        for (size_t i = 0; i < blks.size(); i++)
+        {
+            /* follows the layout of Block::serialize_header() */
+            DataStream s(blks[i].data(), blks[i].data() + blks[i].size());
+            auto &link = chain[i];
+            link.hash = s.get_hash();
+            if (i == 0 && link.hash != fin.blk_hash) return false;
+            uint32_t n;
+            s >> n;
+            n = letoh(n);
+            if (n == 0) return false;
+            std::vector<uint256_t> parents(n);
+            for (auto &h: parents) s >> h;
+            link.parent = parents[0];
+            uint256_t cmd_root;
+            s >> cmd_root >> n;
+            n = letoh(n);
+            if (i == 0 && (cmd_proof.nleaves != n ||
+                            !cmd_proof.verify(fin.cmd_hash, cmd_root)))
+                return false;
+            /* the voters of the certified block have checked its QC, so only
+             * the direct chain up to it is needed (see HotStuffCore::update) */
+            if (i + commit_depth >= blks.size())
+            {
+                uint8_t flag;
+                s >> flag;
+                if (!flag) return false;
+                link.qc_ref = parse_qc(s)->get_obj_hash();
+            }
+        }
+        DataStream s(qc.data(), qc.data() + qc.size());
+        auto _qc = parse_qc(s);
+        return check_commit_chain(chain, _qc->get_obj_hash()) && _qc->verify(config);
+    } catch (std::exception &) {
+        return false;
+    }
+}
+
+BlockLink::BlockLink(const Block &blk): hash(blk.get_hash()) {
+    const auto &parents = blk.get_parent_hashes();
+    if (!parents.empty()) parent = parents[0];
+    if (blk.get_qc()) qc_ref = blk.get_qc()->get_obj_hash();
+}
+
+bool check_commit_chain(const std::vector<BlockLink> &chain, const uint256_t &qc_ref) {
+    if (chain.size() <= commit_depth) return false;
+    for (size_t i = 1; i < chain.size(); i++)
+    {
+        /* commit requires direct parents */
+        if (chain[i].parent != chain[i - 1].hash) return false;
+        /* and the certification of each one by the next */
+        if (i + commit_depth >= chain.size() &&
+            chain[i].qc_ref != chain[i - 1].hash)
+            return false;
+    }
+    return chain.back().hash == qc_ref;
+}
+
 }
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include "hotstuff/entity.h"
 #include "hotstuff/crypto.h"
 
@@ -22,6 +24,13 @@ namespace hotstuff {
 secp256k1_context_t secp256k1_default_sign_ctx = new Secp256k1Context(true);
 secp256k1_context_t secp256k1_default_verify_ctx = new Secp256k1Context(false);
 
+/* the signatures of a QC are spread over all the workers, and only batched
+ * if there are more of them than the workers */
+static size_t verify_batch_size(size_t nsigs, const VeriPool &vpool) {
+    size_t nworker = std::max(vpool.get_nworker(), (size_t)1);
+    return std::max((nsigs + nworker - 1) / nworker, (size_t)1);
+}
+
 QuorumCertSecp256k1::QuorumCertSecp256k1(
         const ReplicaConfig &config, const uint256_t &obj_hash):
             QuorumCert(), obj_hash(obj_hash), rids(config.nreplicas) {
@@ -38,7 +47,7 @@ bool QuorumCertSecp256k1::verify(const ReplicaConfig &config) {
             if (!sigs[i].verify(obj_hash,
                             static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i)),
                             secp256k1_default_verify_ctx))
-            return false;
+                return false;
         }
     return true;
 }
@@ -47,15 +56,115 @@ promise_t QuorumCertSecp256k1::verify(const ReplicaConfig &config, VeriPool &vpo
     if (sigs.size() < config.nmajority)
         return promise_t([](promise_t &pm) { pm.resolve(false); });
     std::vector<promise_t> vpm;
+    const size_t batch_size = verify_batch_size(sigs.size(), vpool);
+    Secp256k1BatchVeriTask *task = nullptr;
     for (size_t i = 0; i < rids.size(); i++)
         if (rids.get(i))
         {
             HOTSTUFF_LOG_DEBUG("checking cert(%d), obj_hash=%s",
                                 i, get_hex10(obj_hash).c_str());
-            vpm.push_back(vpool.verify(new Secp256k1VeriTask(obj_hash,
-                            static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i)),
-                            sigs[i])));
+            if (!task) task = new Secp256k1BatchVeriTask(obj_hash);
+            task->add(static_cast<const PubKeySecp256k1 &>(config.get_pubkey(i)), sigs[i]);
+            if (task->size() == batch_size)
+            {
+                vpm.push_back(vpool.verify(task));
+                task = nullptr;
+            }
+        }
+    if (task) vpm.push_back(vpool.verify(task));
+    return promise::all(vpm).then([](const promise::values_t &values) {
+        for (const auto &v: values)
+            if (!promise::any_cast<bool>(v)) return false;
+        return true;
+    });
+}
+
+void PubKeyEd25519::load() {
+    EVP_PKEY_free(pkey);
+    pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, nullptr, data, nbytes);
+    if (!pkey)
+        throw std::invalid_argument("invalid ed25519 public key");
+}
+
+PubKeyEd25519::PubKeyEd25519(const PubKeyEd25519 &other):
+        PubKey(), pkey(other.pkey) {
+    memmove(data, other.data, nbytes);
+    if (pkey) EVP_PKEY_up_ref(pkey);
+}
+
+PubKeyEd25519::PubKeyEd25519(const PrivKeyEd25519 &priv_key):
+        PubKey(), pkey(nullptr) {
+    size_t len = nbytes;
+    if (!priv_key.pkey ||
+        !EVP_PKEY_get_raw_public_key(priv_key.pkey, data, &len))
+        throw std::invalid_argument("invalid ed25519 private key");
+    load();
+}
+
+void PrivKeyEd25519::load() {
+    EVP_PKEY_free(pkey);
+    pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, nullptr, data, nbytes);
+    if (!pkey)
+        throw std::invalid_argument("invalid ed25519 private key");
+}
+
+void SigEd25519::sign(const bytearray_t &msg, const PrivKeyEd25519 &priv_key) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    size_t len = nbytes;
+    bool ok = ctx &&
+        EVP_DigestSignInit(ctx, nullptr, nullptr, nullptr, priv_key.pkey) == 1 &&
+        EVP_DigestSign(ctx, data, &len, msg.data(), msg.size()) == 1;
+    EVP_MD_CTX_free(ctx);
+    if (!ok)
+        throw std::invalid_argument("failed to create ed25519 signature");
+}
+
+bool SigEd25519::verify(const bytearray_t &msg, const PubKeyEd25519 &pub_key) const {
+    if (!pub_key.pkey) return false;
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    bool ok = ctx &&
+        EVP_DigestVerifyInit(ctx, nullptr, nullptr, nullptr, pub_key.pkey) == 1 &&
+        EVP_DigestVerify(ctx, data, nbytes, msg.data(), msg.size()) == 1;
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+
+QuorumCertEd25519::QuorumCertEd25519(
+        const ReplicaConfig &config, const uint256_t &obj_hash):
+            QuorumCert(), obj_hash(obj_hash), rids(config.nreplicas) {
+    rids.clear();
+}
+
+bool QuorumCertEd25519::verify(const ReplicaConfig &config) {
+    if (sigs.size() < config.nmajority) return false;
+    for (size_t i = 0; i < rids.size(); i++)
+        if (rids.get(i))
+        {
+            if (!sigs[i].verify(obj_hash,
+                            static_cast<const PubKeyEd25519 &>(config.get_pubkey(i))))
+                return false;
+        }
+    return true;
+}
+
+promise_t QuorumCertEd25519::verify(const ReplicaConfig &config, VeriPool &vpool) {
+    if (sigs.size() < config.nmajority)
+        return promise_t([](promise_t &pm) { pm.resolve(false); });
+    std::vector<promise_t> vpm;
+    const size_t batch_size = verify_batch_size(sigs.size(), vpool);
+    Ed25519BatchVeriTask *task = nullptr;
+    for (size_t i = 0; i < rids.size(); i++)
+        if (rids.get(i))
+        {
+            if (!task) task = new Ed25519BatchVeriTask(obj_hash);
+            task->add(static_cast<const PubKeyEd25519 &>(config.get_pubkey(i)), sigs[i]);
+            if (task->size() == batch_size)
+            {
+                vpm.push_back(vpool.verify(task));
+                task = nullptr;
+            }
         }
+    if (task) vpm.push_back(vpool.verify(task));
     return promise::all(vpm).then([](const promise::values_t &values) {
         for (const auto &v: values)
             if (!promise::any_cast<bool>(v)) return false;
@@ -59,7 +59,53 @@ void Block::unserialize(DataStream &s, HotStuffCore *hsc) {
         auto base = s.get_data_inplace(n);
         extra = bytearray_t(base, base + n);
     }
-    this->hash = salticidae::get_hash(*this);
+    cmd_root = merkle_root(cmds);
+    ncmds = cmds.size();
+    this->hash = get_header_hash();
+}
+
+void Block::serialize_header(DataStream &s) const {
+    s << htole((uint32_t)parent_hashes.size());
+    for (const auto &hash: parent_hashes)
+        s << hash;
+    s << cmd_root << htole(ncmds);
+    if (qc)
+        s << (uint8_t)1 << *qc;
+    else
+        s << (uint8_t)0;
+    s << htole((uint32_t)extra.size()) << extra;
+}
+
+void Block::unserialize_header(DataStream &s, HotStuffCore *hsc) {
+    uint32_t n;
+    uint8_t flag;
+    s >> n;
+    n = letoh(n);
+    parent_hashes.resize(n);
+    for (auto &hash: parent_hashes)
+        s >> hash;
+    s >> cmd_root >> ncmds;
+    ncmds = letoh(ncmds);
+    cmds.clear();
+    s >> flag;
+    qc = flag ? hsc->parse_quorum_cert(s) : nullptr;
+    s >> n;
+    n = letoh(n);
+    if (n == 0)
+        extra.clear();
+    else
+    {
+        auto base = s.get_data_inplace(n);
+        extra = bytearray_t(base, base + n);
+    }
+    this->hash = get_header_hash();
+}
+
+bool Block::set_body(std::vector<uint256_t> &&_cmds) {
+    if (_cmds.size() != ncmds || merkle_root(_cmds) != cmd_root)
+        return false;
+    cmds = std::move(_cmds);
+    return true;
 }
 
 bool Block::verify(const HotStuffCore *hsc) const {
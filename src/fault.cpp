@@ -0,0 +1,163 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <sstream>
+
+#include "hotstuff/util.h"
+#include "hotstuff/fault.h"
+
+namespace hotstuff {
+
+static int32_t parse_wildcard(const std::string &s) {
+    if (s == "*") return -1;
+    return std::stoi(s, nullptr, 0);
+}
+
+FaultInjector::FaultInjector(const EventContext &ec, ReplicaID rid, uint64_t seed):
+        rid(rid),
+        /* each replica draws from its own (but reproducible) sequence */
+        rng(seed * 0x9e3779b97f4a7c15ULL + rid),
+        dist(0, 1),
+        start_time(clock_t::now()),
+        ndropped(0), ndelayed(0), nduplicated(0) {
+    deferred_timer = TimerEvent(ec, [this](TimerEvent &) { on_deferred(); });
+}
+
+void FaultInjector::load(const std::string &fname) {
+    std::ifstream in(fname);
+    if (!in)
+        throw HotStuffError("cannot open the fault schedule %s", fname.c_str());
+    std::string line;
+    for (size_t lineno = 1; std::getline(in, line); lineno++)
+    {
+        auto pos = line.find('#');
+        if (pos != std::string::npos) line.resize(pos);
+        std::istringstream ss(line);
+        std::string action;
+        Rule rule;
+        if (!(ss >> rule.start)) continue; /* blank line */
+        if (!(ss >> rule.end >> action))
+            throw HotStuffError("%s:%lu: malformed rule", fname.c_str(), lineno);
+        rule.dest = rule.opcode = -1;
+        rule.prob = 1;
+        rule.param = 0;
+        try {
+            if (action == "partition")
+            {
+                rule.action = PARTITION;
+                std::string group;
+                ss >> group;
+                for (const auto &r: salticidae::split(group, ","))
+                    rule.group.insert(std::stoi(r));
+            }
+            else
+            {
+                std::string dest, opcode;
+                if (!(ss >> dest >> opcode >> rule.prob))
+                    throw HotStuffError("missing fields");
+                rule.dest = parse_wildcard(dest);
+                rule.opcode = parse_wildcard(opcode);
+                if (action == "drop") rule.action = DROP;
+                else if (action == "duplicate") rule.action = DUPLICATE;
+                else if (action == "delay") rule.action = DELAY;
+                else if (action == "reorder") rule.action = REORDER;
+                else throw HotStuffError("unknown action %s", action.c_str());
+                if ((rule.action == DELAY || rule.action == REORDER) &&
+                    !(ss >> rule.param))
+                    throw HotStuffError("missing the delay");
+            }
+        } catch (std::exception &e) {
+            throw HotStuffError("%s:%lu: %s", fname.c_str(), lineno, e.what());
+        }
+        rules.push_back(std::move(rule));
+    }
+    HOTSTUFF_LOG_INFO("loaded %lu fault rules from %s", rules.size(), fname.c_str());
+}
+
+void FaultInjector::start() {
+    start_time = clock_t::now();
+    HOTSTUFF_LOG_INFO("fault injection started");
+}
+
+double FaultInjector::now() const {
+    return std::chrono::duration<double>(clock_t::now() - start_time).count();
+}
+
+FaultInjector::Verdict FaultInjector::judge(ReplicaID dest, opcode_t opcode) {
+    Verdict v;
+    double t = now();
+    for (const auto &rule: rules)
+    {
+        if (t < rule.start || t >= rule.end) continue;
+        if (rule.action == PARTITION)
+        {
+            if (rule.group.count(rid) != rule.group.count(dest))
+            {
+                /* no later rule may let the message through */
+                v.ncopies = 0;
+                break;
+            }
+            continue;
+        }
+        if ((rule.dest != -1 && rule.dest != dest) ||
+            (rule.opcode != -1 && rule.opcode != opcode))
+            continue;
+        if (dist(rng) >= rule.prob) continue;
+        switch (rule.action)
+        {
+            case DROP: v.ncopies = 0; break;
+            case DUPLICATE: v.ncopies++; break;
+            case DELAY: v.delay += rule.param; break;
+            case REORDER: v.delay += dist(rng) * rule.param; break;
+            default: break;
+        }
+        if (v.ncopies == 0) break;
+    }
+    if (v.ncopies == 0) ndropped++;
+    else
+    {
+        nduplicated += v.ncopies - 1;
+        if (v.delay > 0) ndelayed++;
+    }
+    return v;
+}
+
+void FaultInjector::defer(double delay, callback_t cb) {
+    double due = now() + delay;
+    bool earliest = deferred.empty() || due < deferred.begin()->first;
+    deferred.insert(std::make_pair(due, std::move(cb)));
+    if (earliest)
+    {
+        deferred_timer.del();
+        deferred_timer.add(delay);
+    }
+}
+
+void FaultInjector::on_deferred() {
+    double t = now();
+    while (!deferred.empty() && deferred.begin()->first <= t)
+    {
+        auto cb = std::move(deferred.begin()->second);
+        deferred.erase(deferred.begin());
+        cb();
+    }
+    if (!deferred.empty())
+        deferred_timer.add(deferred.begin()->first - t);
+}
+
+}
@@ -0,0 +1,122 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "hotstuff/util.h"
+#include "hotstuff/feed.h"
+
+namespace hotstuff {
+
+using salticidae::_1;
+using salticidae::_2;
+
+const opcode_t MsgFeedSub::opcode;
+const opcode_t MsgFeedAck::opcode;
+const opcode_t MsgFeedRecords::opcode;
+const opcode_t MsgFeedGone::opcode;
+
+CommitFeed::CommitFeed(const NetAddr &listen_addr,
+                        size_t max_records,
+                        size_t max_batch,
+                        const Net::Config &config):
+        net(ec, config),
+        max_records(max_records),
+        max_batch(std::max(max_batch, (size_t)1)) {
+    queue.reg_handler(ec, [this](queue_t &q) {
+        CommitRecord rec;
+        while (q.try_dequeue(rec))
+        {
+            /* only consecutive heights are kept (e.g., not across a restart
+             * from an older snapshot) */
+            if (!records.empty() && rec.height != records.back().height + 1)
+            {
+                HOTSTUFF_LOG_WARN("commit feed: gap before height %u", rec.height);
+                records.clear();
+            }
+            records.push_back(std::move(rec));
+            if (records.size() > this->max_records) records.pop_front();
+        }
+        for (auto it = subs.begin(); it != subs.end();)
+        {
+            if (pump(it->first, it->second)) it++;
+            else it = subs.erase(it);
+        }
+        return false;
+    });
+    net.reg_handler(salticidae::generic_bind(&CommitFeed::sub_handler, this, _1, _2));
+    net.reg_handler(salticidae::generic_bind(&CommitFeed::ack_handler, this, _1, _2));
+    net.reg_conn_handler([this](const salticidae::ConnPool::conn_t &_conn, bool connected) {
+        if (!connected)
+            subs.erase(salticidae::static_pointer_cast<Net::conn_t::type>(_conn));
+        return true;
+    });
+    net.start();
+    net.listen(listen_addr);
+    tcall = new salticidae::ThreadCall(ec);
+    handle = std::thread([this]() { ec.dispatch(); });
+}
+
+CommitFeed::~CommitFeed() {
+    tcall->async_call([this](salticidae::ThreadCall::Handle &) {
+        ec.stop();
+    });
+    handle.join();
+}
+
+void CommitFeed::sub_handler(MsgFeedSub &&msg, const Net::conn_t &conn) {
+    auto &sub = subs[conn];
+    sub.next = msg.cursor + 1;
+    sub.acked = msg.cursor;
+    sub.window = std::max(msg.window, (uint32_t)1);
+    if (!pump(conn, sub)) subs.erase(conn);
+}
+
+void CommitFeed::ack_handler(MsgFeedAck &&msg, const Net::conn_t &conn) {
+    auto it = subs.find(conn);
+    if (it == subs.end()) return;
+    auto &sub = it->second;
+    if (msg.height > sub.acked && msg.height < sub.next)
+    {
+        sub.acked = msg.height;
+        if (!pump(conn, sub)) subs.erase(it);
+    }
+}
+
+bool CommitFeed::pump(const Net::conn_t &conn, Subscriber &sub) {
+    if (records.empty()) return true;
+    uint32_t base = records.front().height;
+    uint32_t tail = records.back().height;
+    if (sub.next < base)
+    {
+        /* also when falling behind while waiting for the acks */
+        net.send_msg(MsgFeedGone(base), conn);
+        return false;
+    }
+    while (sub.next <= tail && sub.next - sub.acked <= sub.window)
+    {
+        size_t n = std::min({(size_t)(tail - sub.next + 1),
+                            (size_t)(sub.acked + sub.window + 1 - sub.next),
+                            max_batch});
+        auto begin = records.begin() + (sub.next - base);
+        net.send_msg(MsgFeedRecords(begin, begin + n), conn);
+        sub.next += n;
+    }
+    return true;
+}
+
+}
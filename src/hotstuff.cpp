@@ -15,6 +15,14 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "hotstuff/hotstuff.h"
 #include "hotstuff/client.h"
 #include "hotstuff/liveness.h"
@@ -75,9 +83,183 @@ void MsgRespBlock::postponed_parse(HotStuffCore *hsc) {
     }
 }
 
+const opcode_t MsgCheckpoint::opcode;
+MsgCheckpoint::MsgCheckpoint(const CheckpointVote &vote) { serialized << vote; }
+void MsgCheckpoint::postponed_parse(HotStuffCore *hsc) {
+    vote.hsc = hsc;
+    serialized >> vote;
+}
+
+const opcode_t MsgBatch::opcode;
+MsgBatch::MsgBatch(uint32_t nmsgs, const DataStream &payload) {
+    serialized << htole(nmsgs);
+    serialized.put_data(payload.data(), payload.data() + payload.size());
+}
+
+MsgBatch::MsgBatch(DataStream &&s) {
+    uint32_t nmsgs;
+    s >> nmsgs;
+    nmsgs = letoh(nmsgs);
+    while (nmsgs--)
+    {
+        opcode_t opcode;
+        uint32_t len;
+        s >> opcode >> len;
+        len = letoh(len);
+        auto base = s.get_data_inplace(len);
+        msgs.push_back(std::make_pair(opcode, DataStream(base, base + len)));
+    }
+}
+
+const opcode_t MsgCompressed::opcode;
+MsgCompressed::MsgCompressed(opcode_t inner_opcode, uint32_t raw_size,
+                            const bytearray_t &data) {
+    serialized << inner_opcode << htole(raw_size);
+    serialized.put_data(data.data(), data.data() + data.size());
+}
+
+MsgCompressed::MsgCompressed(DataStream &&s) {
+    s >> inner_opcode >> raw_size;
+    raw_size = letoh(raw_size);
+    size_t len = s.size();
+    auto base = s.get_data_inplace(len);
+    data = bytearray_t(base, base + len);
+}
+
+const opcode_t MsgCompressCaps::opcode;
+MsgCompressCaps::MsgCompressCaps(bool supported, bool ask,
+                                const uint256_t &dict_hash) {
+    serialized << (uint8_t)((supported ? 1 : 0) | (ask ? 2 : 0)) << dict_hash;
+}
+
+MsgCompressCaps::MsgCompressCaps(DataStream &&s) {
+    uint8_t flags;
+    s >> flags >> dict_hash;
+    supported = flags & 1;
+    ask = flags & 2;
+}
+
+const opcode_t MsgReadIndexReq::opcode;
+MsgReadIndexReq::MsgReadIndexReq(uint64_t nonce) { serialized << htole(nonce); }
+MsgReadIndexReq::MsgReadIndexReq(DataStream &&s) {
+    s >> nonce;
+    nonce = letoh(nonce);
+}
+
+const opcode_t MsgReadIndexResp::opcode;
+MsgReadIndexResp::MsgReadIndexResp(uint64_t nonce, uint32_t vheight) {
+    serialized << htole(nonce) << htole(vheight);
+}
+
+MsgReadIndexResp::MsgReadIndexResp(DataStream &&s) {
+    s >> nonce >> vheight;
+    nonce = letoh(nonce);
+    vheight = letoh(vheight);
+}
+
+const opcode_t MsgLearn::opcode;
+MsgLearn::MsgLearn(uint32_t height) { serialized << htole(height); }
+MsgLearn::MsgLearn(DataStream &&s) {
+    s >> height;
+    height = letoh(height);
+}
+
+const opcode_t MsgCommitted::opcode;
+MsgCommitted::MsgCommitted(const std::vector<block_t> &blks, const QuorumCert &qc) {
+    serialized << htole((uint32_t)blks.size());
+    for (auto blk: blks) serialized << *blk;
+    serialized << qc;
+}
+
+void MsgCommitted::postponed_parse(HotStuffCore *hsc) {
+    uint32_t size;
+    serialized >> size;
+    size = letoh(size);
+    blks.resize(size);
+    for (auto &blk: blks)
+    {
+        Block _blk;
+        _blk.unserialize(serialized, hsc);
+        blk = hsc->storage->add_blk(std::move(_blk), hsc->get_config());
+    }
+    qc = hsc->parse_quorum_cert(serialized);
+}
+
+const opcode_t MsgReqSegment::opcode;
+MsgReqSegment::MsgReqSegment(uint32_t from, uint32_t to) {
+    serialized << htole(from) << htole(to);
+}
+
+MsgReqSegment::MsgReqSegment(DataStream &&s) {
+    s >> from >> to;
+    from = letoh(from);
+    to = letoh(to);
+}
+
+const opcode_t MsgRespSegment::opcode;
+MsgRespSegment::MsgRespSegment(uint32_t from, uint32_t to,
+                                const std::vector<block_t> &blks,
+                                const QuorumCert *qc) {
+    serialized << htole(from) << htole(to) << htole((uint32_t)blks.size());
+    for (auto blk: blks) serialized << *blk;
+    if (qc) serialized << *qc;
+}
+
+void MsgRespSegment::postponed_parse(HotStuffCore *hsc) {
+    uint32_t size;
+    serialized >> from >> to >> size;
+    from = letoh(from);
+    to = letoh(to);
+    size = letoh(size);
+    blks.resize(size);
+    for (auto &blk: blks)
+    {
+        Block _blk;
+        _blk.unserialize(serialized, hsc);
+        blk = hsc->storage->add_blk(std::move(_blk), hsc->get_config());
+    }
+    if (to == 0 && size > 0)
+        qc = hsc->parse_quorum_cert(serialized);
+}
+
+const opcode_t MsgProposeHeader::opcode;
+MsgProposeHeader::MsgProposeHeader(const Proposal &proposal) {
+    serialized << proposal.proposer;
+    proposal.blk->serialize_header(serialized);
+}
+
+void MsgProposeHeader::postponed_parse(HotStuffCore *hsc) {
+    proposal.hsc = hsc;
+    serialized >> proposal.proposer;
+    Block _blk;
+    _blk.unserialize_header(serialized, hsc);
+    proposal.blk = hsc->storage->add_blk(std::move(_blk), hsc->get_config());
+}
+
+const opcode_t MsgBlockBody::opcode;
+MsgBlockBody::MsgBlockBody(const Block &blk) {
+    const auto &cmds = blk.get_cmds();
+    serialized << blk.get_hash() << htole((uint32_t)cmds.size());
+    for (const auto &cmd: cmds)
+        serialized << cmd;
+}
+
+MsgBlockBody::MsgBlockBody(DataStream &&s) {
+    uint32_t size;
+    s >> blk_hash >> size;
+    size = letoh(size);
+    cmds.resize(size);
+    for (auto &cmd: cmds) s >> cmd;
+}
+
 // TODO: improve this function
 void HotStuffBase::exec_command(uint256_t cmd_hash, commit_cb_t callback) {
-    cmd_pending.enqueue(std::make_pair(cmd_hash, callback));
+    cmd_pending.enqueue(CmdRequest(cmd_hash, std::move(callback)));
+}
+
+void HotStuffBase::exec_command(uint256_t cmd_hash, uint32_t cid, uint64_t seq,
+                                commit_cb_t callback) {
+    cmd_pending.enqueue(CmdRequest(cmd_hash, std::move(callback), true, cid, seq));
 }
 
 void HotStuffBase::on_fetch_blk(const block_t &blk) {
@@ -97,6 +279,17 @@ void HotStuffBase::on_fetch_blk(const block_t &blk) {
     }
 }
 
+void HotStuffBase::on_fetch_body(const block_t &blk) {
+    auto it = body_fetch_waiting.find(blk->get_hash());
+    if (it != body_fetch_waiting.end())
+    {
+        LOG_DEBUG("fetched the body of %.10s", get_hex(blk->get_hash()).c_str());
+        it->second.resolve(blk);
+        body_fetch_waiting.erase(it);
+    }
+    on_receive_body(blk);
+}
+
 void HotStuffBase::on_deliver_blk(const block_t &blk) {
     const uint256_t &blk_hash = blk->get_hash();
     bool valid;
@@ -139,6 +332,32 @@ void HotStuffBase::on_deliver_blk(const block_t &blk) {
     }
 }
 
+void HotStuffBase::drain_stale_delivery() {
+    std::vector<BlockDeliveryContext> stale;
+    for (auto it = blk_delivery_waiting.begin(); it != blk_delivery_waiting.end();)
+    {
+        auto &pm = it->second;
+        pm.elapsed.stop(false);
+        if (pm.elapsed.elapsed_sec < blk_delivery_stale_timeout)
+        {
+            it++;
+            continue;
+        }
+        const uint256_t blk_hash = it->first;
+        LOG_WARN("dropping stale delivery of %.10s", get_hex(blk_hash).c_str());
+        stale.push_back(std::move(pm));
+        it = blk_delivery_waiting.erase(it);
+        blk_fetch_waiting.erase(blk_hash);
+        delivery_pending.erase(blk_hash);
+        delivery_dependents.erase(blk_hash);
+        delivery_fetching.erase(blk_hash);
+        delivery_fetch_slow.erase(blk_hash);
+    }
+    for (auto &pm: stale) pm.reject();
+    /* the queued fetches may take the freed slots */
+    pump_delivery_fetch();
+}
+
 promise_t HotStuffBase::async_fetch_blk(const uint256_t &blk_hash,
                                         const NetAddr *replica_id,
                                         bool fetch_now) {
@@ -162,34 +381,170 @@ promise_t HotStuffBase::async_fetch_blk(const uint256_t &blk_hash,
     return static_cast<promise_t &>(it->second);
 }
 
+promise_t HotStuffBase::async_fetch_body(const block_t &blk) {
+    if (blk->has_body())
+        return promise_t([blk](promise_t pm) { pm.resolve(blk); });
+    const uint256_t &blk_hash = blk->get_hash();
+    auto it = body_fetch_waiting.find(blk_hash);
+    if (it == body_fetch_waiting.end())
+    {
+        it = body_fetch_waiting.insert(
+            std::make_pair(
+                blk_hash,
+                BlockFetchContext(blk_hash, this))).first;
+        /* only asked upon timeout, any replica could serve it */
+        for (const auto &peer: peers)
+            it->second.add_replica(peer, false);
+    }
+    return static_cast<promise_t &>(it->second);
+}
+
 promise_t HotStuffBase::async_deliver_blk(const uint256_t &blk_hash,
                                         const NetAddr &replica_id) {
     if (storage->is_blk_delivered(blk_hash))
         return promise_t([this, &blk_hash](promise_t pm) {
             pm.resolve(storage->find_blk(blk_hash));
         });
+    start_delivery(blk_hash, replica_id);
+    /* the context could be gone already if the block is already fetched */
     auto it = blk_delivery_waiting.find(blk_hash);
     if (it != blk_delivery_waiting.end())
         return static_cast<promise_t &>(it->second);
-    BlockDeliveryContext pm{[](promise_t){}};
-    it = blk_delivery_waiting.insert(std::make_pair(blk_hash, pm)).first;
-    /* otherwise the on_deliver_batch will resolve */
-    async_fetch_blk(blk_hash, &replica_id).then([this, replica_id](block_t blk) {
-        /* qc_ref should be fetched */
-        std::vector<promise_t> pms;
-        const auto &qc = blk->get_qc();
-        if (qc)
-            pms.push_back(async_fetch_blk(qc->get_obj_hash(), &replica_id));
-        /* the parents should be delivered */
-        for (const auto &phash: blk->get_parent_hashes())
-            pms.push_back(async_deliver_blk(phash, replica_id));
-        if (blk != get_genesis())
-            pms.push_back(blk->verify(this, vpool));
-        promise::all(pms).then([this, blk]() {
-            on_deliver_blk(blk);
-        });
+    block_t blk = storage->find_blk(blk_hash);
+    return promise_t([blk](promise_t pm) {
+        if (blk && blk->is_delivered())
+            pm.resolve(blk);
+        else
+            pm.reject(blk);
     });
-    return static_cast<promise_t &>(pm);
+}
+
+void HotStuffBase::start_delivery(const uint256_t &blk_hash,
+                                const NetAddr &replica_id) {
+    if (blk_delivery_waiting.count(blk_hash)) return;
+    blk_delivery_waiting.insert(std::make_pair(blk_hash,
+                                BlockDeliveryContext([](promise_t){})));
+    /* a block at hand (e.g., a proposal) never waits behind the fetches */
+    if (storage->is_blk_fetched(blk_hash))
+        delivery_local_queue.push_back(std::make_pair(blk_hash, replica_id));
+    else
+        delivery_fetch_queue.push_back(std::make_pair(blk_hash, replica_id));
+    if (!delivery_timer.is_pending())
+        delivery_timer.add(delivery_slot_timeout / 2);
+    pump_delivery_fetch();
+}
+
+void HotStuffBase::pump_delivery_fetch() {
+    /* the fetches resolved right away are handled by the loop, without
+     * nesting */
+    if (delivery_pumping) return;
+    delivery_pumping = true;
+    for (;;)
+    {
+        std::pair<uint256_t, NetAddr> e;
+        if (!delivery_local_queue.empty())
+        {
+            e = std::move(delivery_local_queue.front());
+            delivery_local_queue.pop_front();
+        }
+        else
+        {
+            if (delivery_fetch_queue.empty()) break;
+            /* only an actual fetch takes a slot */
+            if (delivery_fetching.size() >= max_delivery_fetch &&
+                !storage->is_blk_fetched(delivery_fetch_queue.front().first))
+                break;
+            e = std::move(delivery_fetch_queue.front());
+            delivery_fetch_queue.pop_front();
+        }
+        const uint256_t &blk_hash = e.first;
+        /* dropped as stale meanwhile */
+        if (!blk_delivery_waiting.count(blk_hash)) continue;
+        if (storage->is_blk_fetched(blk_hash))
+        {
+            on_delivery_fetched(storage->find_blk(blk_hash), e.second);
+            continue;
+        }
+        delivery_fetching.insert(std::make_pair(blk_hash,
+                                std::chrono::steady_clock::now()));
+        async_fetch_blk(blk_hash, &e.second).then(
+                [this, replica_id = e.second](block_t blk) {
+            const uint256_t &hash = blk->get_hash();
+            /* dropped as stale meanwhile */
+            if (!delivery_fetching.erase(hash) &&
+                !delivery_fetch_slow.erase(hash))
+                return;
+            on_delivery_fetched(blk, replica_id);
+        });
+    }
+    delivery_pumping = false;
+}
+
+void HotStuffBase::on_delivery_fetched(const block_t &blk, const NetAddr &replica_id) {
+    const uint256_t blk_hash = blk->get_hash();
+    /* held until all the dependencies are counted */
+    delivery_pending[blk_hash] = DeliveryNode{blk, 1};
+    auto &node = delivery_pending[blk_hash];
+    /* the parents should be delivered */
+    for (const auto &phash: blk->get_parent_hashes())
+    {
+        if (storage->is_blk_delivered(phash)) continue;
+        node.nmissing++;
+        delivery_dependents[phash].push_back(blk_hash);
+        start_delivery(phash, replica_id);
+    }
+    /* qc_ref should be fetched */
+    std::vector<promise_t> pms;
+    const auto &qc = blk->get_qc();
+    if (qc)
+        pms.push_back(async_fetch_blk(qc->get_obj_hash(), &replica_id));
+    if (blk != get_genesis())
+        pms.push_back(blk->verify(this, vpool));
+    for (auto &pm: pms)
+    {
+        node.nmissing++;
+        pm.then([this, blk_hash]() { on_delivery_dep(blk_hash); });
+    }
+    on_delivery_dep(blk_hash);
+    pump_delivery_fetch();
+    /* a long chain of blocks waiting for their parents: far behind */
+    if (sync_segment_size && delivery_pending.size() >= sync_segment_size &&
+        !sync_timer.is_pending())
+        start_sync();
+}
+
+void HotStuffBase::on_delivery_dep(const uint256_t &blk_hash) {
+    auto it = delivery_pending.find(blk_hash);
+    if (it == delivery_pending.end()) return;
+    if (--it->second.nmissing == 0) deliver_ready(it->second.blk);
+}
+
+void HotStuffBase::deliver_ready(const block_t &blk) {
+    auto cmp = [](const block_t &a, const block_t &b) {
+        return a->get_height() > b->get_height();
+    };
+    std::priority_queue<block_t, std::vector<block_t>, decltype(cmp)> ready(cmp);
+    ready.push(blk);
+    while (!ready.empty())
+    {
+        block_t b = ready.top();
+        ready.pop();
+        const uint256_t blk_hash = b->get_hash();
+        delivery_pending.erase(blk_hash);
+        on_deliver_blk(b);
+        auto it = delivery_dependents.find(blk_hash);
+        if (it == delivery_dependents.end()) continue;
+        auto dependents = std::move(it->second);
+        delivery_dependents.erase(it);
+        /* the dependents of an invalid block are left to go stale */
+        if (!storage->is_blk_delivered(blk_hash)) continue;
+        for (const auto &h: dependents)
+        {
+            auto nit = delivery_pending.find(h);
+            if (nit != delivery_pending.end() && --nit->second.nmissing == 0)
+                ready.push(nit->second.blk);
+        }
+    }
 }
 
 void HotStuffBase::propose_handler(MsgPropose &&msg, const Net::conn_t &conn) {
@@ -206,6 +561,33 @@ void HotStuffBase::propose_handler(MsgPropose &&msg, const Net::conn_t &conn) {
     });
 }
 
+void HotStuffBase::propose_header_handler(MsgProposeHeader &&msg, const Net::conn_t &conn) {
+    const NetAddr &peer = conn->get_peer_addr();
+    if (peer.is_null()) return;
+    msg.postponed_parse(this);
+    auto &prop = msg.proposal;
+    block_t blk = prop.blk;
+    if (!blk) return;
+    /* the body should follow, start the timeout for fetching it */
+    async_fetch_body(blk);
+    promise::all(std::vector<promise_t>{
+        async_deliver_blk(blk->get_hash(), peer)
+    }).then([this, prop = std::move(prop)]() {
+        on_receive_proposal(prop);
+    });
+}
+
+void HotStuffBase::blk_body_handler(MsgBlockBody &&msg, const Net::conn_t &conn) {
+    const NetAddr &peer = conn->get_peer_addr();
+    if (peer.is_null()) return;
+    block_t blk = storage->find_blk(msg.blk_hash);
+    /* unknown bodies (e.g., overtaking the header) are fetched on timeout */
+    if (!blk || blk->has_body()) return;
+    if (!storage->add_body(blk, std::move(msg.cmds)))
+        LOG_WARN("mismatching body of %.10s from %s",
+                get_hex(msg.blk_hash).c_str(), std::string(peer).c_str());
+}
+
 void HotStuffBase::vote_handler(MsgVote &&msg, const Net::conn_t &conn) {
     const NetAddr &peer = conn->get_peer_addr();
     if (peer.is_null()) return;
@@ -235,16 +617,583 @@ void HotStuffBase::req_blk_handler(MsgReqBlock &&msg, const Net::conn_t &conn) {
         for (auto &v: values)
         {
             auto blk = promise::any_cast<block_t>(v);
-            blks.push_back(blk);
+            /* a block without its body cannot be verified by the requester */
+            if (blk->has_body())
+                blks.push_back(blk);
         }
-        pn.send_msg(MsgRespBlock(blks), replica);
+        if (!blks.empty())
+            send_msg(MsgRespBlock(blks), replica);
     });
 }
 
 void HotStuffBase::resp_blk_handler(MsgRespBlock &&msg, const Net::conn_t &) {
     msg.postponed_parse(this);
     for (const auto &blk: msg.blks)
-        if (blk) on_fetch_blk(blk);
+    {
+        if (!blk) continue;
+        on_fetch_blk(blk);
+    }
+}
+
+void HotStuffBase::ckpt_handler(MsgCheckpoint &&msg, const Net::conn_t &conn) {
+    const NetAddr &peer = conn->get_peer_addr();
+    if (peer.is_null()) return;
+    msg.postponed_parse(this);
+    RcObj<CheckpointVote> v(new CheckpointVote(std::move(msg.vote)));
+    v->verify(vpool).then([this, v=std::move(v)](bool valid) {
+        if (!valid)
+            LOG_WARN("invalid checkpoint vote from %d", v->voter);
+        else
+            on_receive_checkpoint(*v);
+    });
+}
+
+void HotStuffBase::read_index_req_handler(MsgReadIndexReq &&msg, const Net::conn_t &conn) {
+    const NetAddr &peer = conn->get_peer_addr();
+    if (peer.is_null()) return;
+    send_msg(MsgReadIndexResp(msg.nonce, get_vheight()), peer);
+}
+
+void HotStuffBase::read_index_resp_handler(MsgReadIndexResp &&msg, const Net::conn_t &conn) {
+    if (read_confirming.empty() || msg.nonce != read_nonce) return;
+    auto it = peer_rid.find(conn->get_peer_addr());
+    if (it == peer_rid.end()) return;
+    if (!read_acks.insert(it->second).second) return;
+    read_vheight = std::max(read_vheight, msg.vheight);
+    if (read_acks.size() >= get_config().nmajority)
+        finish_read_round();
+}
+
+void HotStuffBase::learn_handler(MsgLearn &&msg, const Net::conn_t &conn) {
+    const NetAddr peer = conn->get_peer_addr();
+    if (peer.is_null()) return;
+    if (std::find_if(learners.begin(), learners.end(),
+            [&peer](const std::pair<NetAddr, uint256_t> &l) {
+                return l.first == peer;
+            }) == learners.end())
+        return;
+    auto &height = learner_height[peer];
+    height = msg.height;
+    feed_learner(peer, height);
+}
+
+void HotStuffBase::feed_learner(const NetAddr &addr, uint32_t &height) {
+    const auto &proof = get_commit_proof();
+    block_t b = get_b_exec();
+    if (!proof.second || b->get_height() <= height) return;
+    /* wait until the execution catches up with the proof (the blocks are
+     * sent with their bodies) */
+    if (proof.first[0]->get_parents()[0] != b) return;
+    for (const auto &blk: proof.first)
+        if (!blk->has_body()) return;
+    std::vector<block_t> blks;
+    while (b->get_height() > height)
+    {
+        blks.push_back(b);
+        if (b->get_parents().empty())
+        {
+            LOG_WARN("learner %s is behind the pruned blocks (at height %u)",
+                    std::string(addr).c_str(), height);
+            return;
+        }
+        b = b->get_parents()[0];
+    }
+    std::reverse(blks.begin(), blks.end());
+    for (const auto &blk: proof.first)
+        blks.push_back(blk);
+    send_msg(MsgCommitted(blks, *proof.second), addr);
+    height = get_b_exec()->get_height();
+}
+
+void HotStuffBase::committed_handler(MsgCommitted &&msg, const Net::conn_t &conn) {
+    const NetAddr peer = conn->get_peer_addr();
+    if (peer.is_null() || !is_learner()) return;
+    msg.postponed_parse(this);
+    auto &blks = msg.blks;
+    std::vector<BlockLink> chain;
+    for (const auto &blk: blks) chain.push_back(BlockLink(*blk));
+    if (!check_commit_chain(chain, msg.qc->get_obj_hash()))
+    {
+        LOG_WARN("mismatching commit proof from %s", std::string(peer).c_str());
+        return;
+    }
+    RcObj<QuorumCert> qc(msg.qc.unwrap());
+    std::vector<promise_t> pms;
+    pms.push_back(qc->verify(get_config(), vpool));
+    /* fetches the uncles not included in the message, if any */
+    for (const auto &blk: blks)
+        pms.push_back(async_deliver_blk(blk->get_hash(), peer));
+    promise::all(pms).then([this, blks, qc, peer](const promise::values_t values) {
+        if (!promise::any_cast<bool>(values[0]))
+        {
+            LOG_WARN("invalid commit proof from %s", std::string(peer).c_str());
+            return;
+        }
+        on_receive_committed(blks[blks.size() - 1 - commit_depth]);
+    });
+}
+
+void HotStuffBase::req_segment_handler(MsgReqSegment &&msg, const Net::conn_t &conn) {
+    const NetAddr peer = conn->get_peer_addr();
+    if (peer.is_null()) return;
+    block_t b = get_b_exec();
+    if (msg.to == 0)
+    {
+        const auto &proof = get_commit_proof();
+        /* the proof should have settled on the executed block (see
+         * feed_learner()) */
+        if (!proof.second || proof.first[0]->get_parents()[0] != b) return;
+        for (const auto &blk: proof.first)
+            if (!blk->has_body()) return;
+        std::vector<block_t> blks{b};
+        blks.insert(blks.end(), proof.first.begin(), proof.first.end());
+        send_msg(MsgRespSegment(b->get_height(), 0, blks, proof.second.get()), peer);
+        return;
+    }
+    if (msg.from == 0 || msg.from > msg.to ||
+        msg.to - msg.from >= sync_segment_limit) return;
+    /* a replica behind the segment sends what it has, and one that pruned
+     * it sends nothing, so the requester moves on to another replica */
+    std::vector<block_t> blks;
+    while (b->get_height() >= msg.from)
+    {
+        if (b->get_height() <= msg.to) blks.push_back(b);
+        if (b->get_height() == msg.from) break;
+        if (b->get_parents().empty())
+        {
+            blks.clear();
+            break;
+        }
+        b = b->get_parents()[0];
+    }
+    std::reverse(blks.begin(), blks.end());
+    send_msg(MsgRespSegment(msg.from, msg.to, blks), peer);
+}
+
+void HotStuffBase::resp_segment_handler(MsgRespSegment &&msg, const Net::conn_t &conn) {
+    const NetAddr peer = conn->get_peer_addr();
+    if (peer.is_null() || !syncing) return;
+    msg.postponed_parse(this);
+    auto it = sync_segments.find(msg.to);
+    if (it == sync_segments.end() || !it->second.blks.empty()) return;
+    auto &seg = it->second;
+    auto &blks = msg.blks;
+    /* both the tip and the segments are chains of direct parents */
+    bool linked = true;
+    for (size_t i = 0; i < blks.size(); i++)
+        if (blks[i]->get_parent_hashes().empty() ||
+            (i > 0 && blks[i]->get_parent_hashes()[0] != blks[i - 1]->get_hash()))
+            linked = false;
+    if (msg.to == 0)
+    {
+        std::vector<BlockLink> chain;
+        for (const auto &blk: blks) chain.push_back(BlockLink(*blk));
+        /* the synced range is executed as committed by the tip */
+        if (!linked || blks.size() != commit_depth + 1 || !msg.qc ||
+            !check_commit_chain(chain, msg.qc->get_obj_hash()))
+        {
+            LOG_WARN("swarm sync: invalid tip from %s", std::string(peer).c_str());
+            if (!request_segment(0, seg)) finish_sync();
+            return;
+        }
+        /* held while the QC is being verified */
+        seg.blks = blks;
+        RcObj<QuorumCert> qc(msg.qc.unwrap());
+        const uint32_t round = sync_round;
+        const uint32_t height = msg.from;
+        qc->verify(get_config(), vpool).then([this, qc, round, height, peer](bool valid) {
+            auto it = sync_segments.find(0);
+            if (round != sync_round || it == sync_segments.end()) return;
+            if (!valid)
+            {
+                LOG_WARN("swarm sync: invalid commit proof from %s",
+                        std::string(peer).c_str());
+                if (!request_segment(0, it->second)) finish_sync();
+                return;
+            }
+            sync_tip = std::move(it->second.blks);
+            sync_segments.erase(it);
+            /* a short range is left to the usual fetching (or feeding) */
+            if (height < sync_from + sync_segment_size ||
+                height <= get_b_exec()->get_height())
+            {
+                LOG_DEBUG("swarm sync: the tip of %s is at height %u",
+                        std::string(peer).c_str(), height);
+                if (is_learner())
+                    for (const auto &addr: learn_source_addrs)
+                        send_msg(MsgLearn(get_b_exec()->get_height()), addr);
+                finish_sync();
+                return;
+            }
+            LOG_INFO("swarm sync: heights %u to %u from %lu replicas",
+                    sync_from, height, get_sync_peers().size());
+            sync_to = sync_next_req = sync_low = height;
+            /* the tip ends the top segment */
+            sync_low++;
+            sync_need = sync_tip[0]->get_hash();
+            sync_tip_peer = peer;
+            pump_sync();
+        });
+        return;
+    }
+    if (!linked || blks.size() != msg.to - msg.from + 1 || msg.from != seg.from)
+    {
+        LOG_DEBUG("swarm sync: incomplete segment [%u, %u] from %s",
+                msg.from, msg.to, std::string(peer).c_str());
+        if (!request_segment(msg.to, seg)) finish_sync();
+        return;
+    }
+    seg.blks = std::move(blks);
+    stitch_segments();
+}
+
+void HotStuffBase::start_sync() {
+    if (syncing || !sync_segment_size || get_sync_peers().empty()) return;
+    syncing = true;
+    sync_round++;
+    const block_t &b = get_b_exec();
+    sync_base = b->get_hash();
+    sync_from = b->get_height() + 1;
+    sync_tip.clear();
+    sync_segments.clear();
+    request_segment(0, sync_segments[0]);
+    sync_timer.add(sync_timeout / 2);
+}
+
+void HotStuffBase::finish_sync() {
+    syncing = false;
+    sync_round++;
+    sync_tip.clear();
+    sync_segments.clear();
+    /* a replica waits a while before starting another one */
+    sync_timer.add(sync_timeout);
+}
+
+bool HotStuffBase::request_segment(uint32_t to, SyncSegment &seg) {
+    const auto &speers = get_sync_peers();
+    /* each replica gets two chances */
+    if (seg.ntries >= 2 * speers.size())
+    {
+        if (to)
+            LOG_WARN("swarm sync: giving up on heights [%u, %u]", seg.from, to);
+        else
+            LOG_WARN("swarm sync: no tip from any replica");
+        return false;
+    }
+    seg.ntries++;
+    seg.peer = sync_rr++ % speers.size();
+    seg.sent = std::chrono::steady_clock::now();
+    seg.blks.clear();
+    send_msg(MsgReqSegment(seg.from, to), speers[seg.peer]);
+    return true;
+}
+
+void HotStuffBase::pump_sync() {
+    /* bounds the blocks received ahead of the stitching */
+    const size_t window = 2 * get_sync_peers().size();
+    while (sync_segments.size() < window && sync_next_req >= sync_from)
+    {
+        const uint32_t to = sync_next_req;
+        auto &seg = sync_segments[to];
+        seg.from = to - std::min(to - sync_from, sync_segment_size - 1);
+        sync_next_req = seg.from - 1;
+        if (!request_segment(to, seg))
+        {
+            finish_sync();
+            return;
+        }
+    }
+}
+
+void HotStuffBase::stitch_segments() {
+    while (sync_low > sync_from)
+    {
+        auto it = sync_segments.find(sync_low - 1);
+        if (it == sync_segments.end() || it->second.blks.empty()) break;
+        auto &seg = it->second;
+        /* linked to the verified tip, so the segment is authentic */
+        if (seg.blks.back()->get_hash() != sync_need)
+        {
+            LOG_WARN("swarm sync: segment [%u, %u] does not link to the tip",
+                    seg.from, it->first);
+            if (!request_segment(it->first, seg)) finish_sync();
+            return;
+        }
+        sync_need = seg.blks[0]->get_parent_hashes()[0];
+        sync_low = seg.from;
+        nsynced += seg.blks.size();
+        /* completes any fetch of them, e.g., by the delivery walking down
+         * the chain meanwhile */
+        for (const auto &blk: seg.blks) on_fetch_blk(blk);
+        sync_segments.erase(it);
+    }
+    if (sync_low > sync_from)
+    {
+        pump_sync();
+        return;
+    }
+    if (sync_need != sync_base)
+    {
+        /* either the tip lied about its height or the executed block has
+         * been pruned away by a reset; start over */
+        LOG_WARN("swarm sync: heights %u to %u do not extend the executed block",
+                sync_from, sync_to);
+        finish_sync();
+        return;
+    }
+    LOG_INFO("swarm sync: stitched heights %u to %u", sync_from, sync_to);
+    /* all fetched now, so the delivery goes down the chain locally (only
+     * the uncles and the QC references off the chain, if any, are fetched),
+     * and the blocks are then executed as a learner does */
+    auto tip = std::move(sync_tip);
+    std::vector<promise_t> pms;
+    for (const auto &blk: tip)
+        pms.push_back(async_deliver_blk(blk->get_hash(), sync_tip_peer));
+    const uint32_t round = sync_round;
+    sync_timer.del();
+    promise::all(pms).then([this, tip, round](const promise::values_t) {
+        if (round != sync_round) return;
+        finish_sync();
+        on_receive_committed(tip[0]);
+    }, [this, round]() {
+        if (round != sync_round) return;
+        LOG_WARN("swarm sync: failed to deliver the synced blocks");
+        finish_sync();
+    });
+}
+
+promise_t HotStuffBase::async_read_index() {
+    if (!read_index_enabled)
+        return promise_t([](promise_t &pm) { pm.resolve(false); });
+    promise_t pm;
+    read_queued.push_back(PendingRead{pm,
+        std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(read_timeout))});
+    if (!read_timer_scheduled)
+    {
+        read_timer_scheduled = true;
+        read_timer.add(read_timeout / 4);
+    }
+    /* otherwise it joins the next round */
+    if (read_confirming.empty())
+        start_read_round();
+    return pm;
+}
+
+void HotStuffBase::start_read_round() {
+    read_confirming = std::move(read_queued);
+    read_queued.clear();
+    read_nonce++;
+    read_acks.clear();
+    /* a learner does not vote, so it needs a full quorum of the replicas */
+    if (!is_learner()) read_acks.insert(get_id());
+    read_vheight = get_vheight();
+    if (read_acks.size() >= get_config().nmajority)
+        finish_read_round();
+    else
+        multicast_msg(MsgReadIndexReq(read_nonce));
+}
+
+void HotStuffBase::finish_read_round() {
+#ifndef HOTSTUFF_TWO_STEP
+    const uint32_t commit_depth = 2;
+#else
+    const uint32_t commit_depth = 1;
+#endif
+    uint32_t index = read_vheight > commit_depth ? read_vheight - commit_depth : 0;
+    for (auto &r: read_confirming)
+        read_waiting.insert(std::make_pair(index, std::move(r)));
+    read_confirming.clear();
+    if (!read_queued.empty())
+        start_read_round();
+    apply_reads();
+}
+
+void HotStuffBase::apply_reads() {
+    /* b_exec is only updated after all commands of the block are executed */
+    uint32_t height = get_b_exec()->get_height();
+    std::vector<promise_t> ready;
+    for (auto it = read_waiting.begin();
+            it != read_waiting.end() && it->first <= height;)
+    {
+        ready.push_back(std::move(it->second.pm));
+        it = read_waiting.erase(it);
+    }
+    for (auto &pm: ready) pm.resolve(true);
+}
+
+void HotStuffBase::expire_reads() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<promise_t> expired;
+    auto expire = [&](std::vector<PendingRead> &reads) {
+        auto it = std::remove_if(reads.begin(), reads.end(),
+            [&](PendingRead &r) {
+                if (r.deadline > now) return false;
+                expired.push_back(std::move(r.pm));
+                return true;
+            });
+        reads.erase(it, reads.end());
+    };
+    expire(read_queued);
+    expire(read_confirming);
+    for (auto it = read_waiting.begin(); it != read_waiting.end();)
+    {
+        if (it->second.deadline > now) { it++; continue; }
+        expired.push_back(std::move(it->second.pm));
+        it = read_waiting.erase(it);
+    }
+    if (!expired.empty())
+        LOG_WARN("%lu reads timed out", expired.size());
+    /* the abandoned round no longer blocks the queued reads */
+    if (read_confirming.empty() && !read_queued.empty())
+        start_read_round();
+    for (auto &pm: expired) pm.resolve(false);
+}
+
+void HotStuffBase::dispatch_msg(opcode_t opcode, DataStream &&msg, const Net::conn_t &conn) {
+    switch (opcode)
+    {
+        case MsgPropose::opcode:
+            propose_handler(MsgPropose(std::move(msg)), conn);
+            break;
+        case MsgVote::opcode:
+            vote_handler(MsgVote(std::move(msg)), conn);
+            break;
+        case MsgReqBlock::opcode:
+            req_blk_handler(MsgReqBlock(std::move(msg)), conn);
+            break;
+        case MsgRespBlock::opcode:
+            resp_blk_handler(MsgRespBlock(std::move(msg)), conn);
+            break;
+        case MsgBlockBody::opcode:
+            blk_body_handler(MsgBlockBody(std::move(msg)), conn);
+            break;
+        case MsgRespSegment::opcode:
+            resp_segment_handler(MsgRespSegment(std::move(msg)), conn);
+            break;
+        case MsgBatch::opcode:
+            batch_handler(MsgBatch(std::move(msg)), conn);
+            break;
+        default:
+            LOG_WARN("unexpected wrapped message with opcode %u", opcode);
+    }
+}
+
+void HotStuffBase::batch_handler(MsgBatch &&msg, const Net::conn_t &conn) {
+    for (auto &m: msg.msgs)
+    {
+        if (m.first == MsgBatch::opcode)
+            LOG_WARN("nested batch");
+        else
+            dispatch_msg(m.first, std::move(m.second), conn);
+    }
+}
+
+void HotStuffBase::compressed_handler(MsgCompressed &&msg, const Net::conn_t &conn) {
+    if (msg.inner_opcode == MsgCompressed::opcode) return;
+    const NetAddr peer = conn->get_peer_addr();
+    bytearray_t raw;
+    try {
+        /* decompression does not need the local compression to be enabled */
+        if (!compressor) compressor = new Compressor();
+        compressor->decompress(msg.data.data(), msg.data.size(), msg.raw_size, raw);
+    } catch (HotStuffError &e) {
+        LOG_WARN("cannot decompress the message from %s: %s",
+                std::string(peer).c_str(), e.what());
+        /* the sender may have stale capabilities of this replica */
+        if (!peer.is_null()) send_compress_caps(peer, false);
+        return;
+    }
+    dispatch_msg(msg.inner_opcode, DataStream(std::move(raw)), conn);
+}
+
+void HotStuffBase::send_compress_caps(const NetAddr &addr, bool ask) {
+    pn.send_msg(MsgCompressCaps(Compressor::is_supported(), ask,
+            compressor ? compressor->get_dict_hash() : uint256_t()), addr);
+}
+
+void HotStuffBase::compress_caps_handler(MsgCompressCaps &&msg, const Net::conn_t &conn) {
+    const NetAddr peer = conn->get_peer_addr();
+    if (peer.is_null()) return;
+    if (msg.ask) send_compress_caps(peer, false);
+    if (!compress_enabled()) return;
+    auto &caps = peer_compress_caps[peer];
+    bool compatible = msg.supported &&
+                    msg.dict_hash == compressor->get_dict_hash();
+    if (!compatible && (!caps.known || caps.compatible))
+        LOG_WARN("sending uncompressed to %s: it cannot decompress %s",
+                std::string(peer).c_str(),
+                msg.supported ? "with the same dictionary" : "at all");
+    caps.known = true;
+    caps.compatible = compatible;
+}
+
+bool HotStuffBase::compress_to(const NetAddr &addr) {
+    if (!compress_enabled()) return false;
+    auto &caps = peer_compress_caps[addr];
+    if (caps.known) return caps.compatible;
+    /* ask (again, in case it is lost) until the peer tells */
+    auto now = std::chrono::steady_clock::now();
+    if (now - caps.asked >= std::chrono::seconds(1))
+    {
+        caps.asked = now;
+        send_compress_caps(addr, true);
+    }
+    return false;
+}
+
+BoxObj<MsgCompressed> HotStuffBase::compress_msg(opcode_t opcode, const DataStream &msg) {
+    if (!compressor || compress_budget <= 0 ||
+        msg.size() < compress_threshold ||
+        !(opcode == MsgPropose::opcode ||
+        opcode == MsgRespBlock::opcode ||
+        opcode == MsgBlockBody::opcode ||
+        opcode == MsgRespSegment::opcode ||
+        opcode == MsgBatch::opcode))
+        return nullptr;
+    /* refill the CPU budget */
+    auto now = std::chrono::steady_clock::now();
+    compress_credit = std::min(compress_budget, compress_credit +
+        std::chrono::duration<double>(now - compress_last).count() * compress_budget);
+    compress_last = now;
+    if (compress_credit <= 0) return nullptr;
+    bytearray_t data;
+    bool ok = compressor->compress(msg.data(), msg.size(), data);
+    auto end = std::chrono::steady_clock::now();
+    compress_credit -= std::chrono::duration<double>(end - now).count();
+    compress_last = end;
+    if (!ok) return nullptr;
+    ncompressed++;
+    compress_saved += msg.size() - data.size();
+    return new MsgCompressed(opcode, msg.size(), data);
+}
+
+void HotStuffBase::batch_msg(opcode_t opcode, const DataStream &msg, const NetAddr &addr) {
+    auto &buff = batch_buffers[addr];
+    buff.payload << opcode << htole((uint32_t)msg.size());
+    buff.payload.put_data(msg.data(), msg.data() + msg.size());
+    buff.nmsgs++;
+    if (buff.payload.size() >= batch_max_bytes)
+        flush_batch(addr, buff);
+    else if (!batch_scheduled)
+    {
+        batch_scheduled = true;
+        batch_timer.add(batch_delay);
+    }
+}
+
+void HotStuffBase::flush_batch(const NetAddr &addr, BatchBuffer &buff) {
+    if (!buff.nmsgs) return;
+    MsgBatch msg(buff.nmsgs, buff.payload);
+    BoxObj<MsgCompressed> c;
+    if (compress_to(addr)) c = compress_msg(MsgBatch::opcode, msg.serialized);
+    if (c)
+        pn.send_msg(*c, addr);
+    else
+        pn.send_msg(msg, addr);
+    buff.payload = DataStream();
+    buff.nmsgs = 0;
 }
 
 bool HotStuffBase::conn_handler(const salticidae::ConnPool::conn_t &conn, bool connected) {
@@ -262,12 +1211,32 @@ void HotStuffBase::print_stat() const {
     LOG_INFO("-------- queues -------");
     LOG_INFO("blk_fetch_waiting: %lu", blk_fetch_waiting.size());
     LOG_INFO("blk_delivery_waiting: %lu", blk_delivery_waiting.size());
+    LOG_INFO("delivery_fetching: %lu (%lu queued, %lu slow)",
+            delivery_fetching.size(), delivery_fetch_queue.size(),
+            delivery_fetch_slow.size());
     LOG_INFO("decision_waiting: %lu", decision_waiting.size());
+    LOG_INFO("client sessions: %lu", sessions.size());
+    LOG_INFO("read_waiting: %lu",
+            read_queued.size() + read_confirming.size() + read_waiting.size());
     LOG_INFO("-------- misc ---------");
     LOG_INFO("fetched: %lu", fetched);
     LOG_INFO("delivered: %lu", delivered);
     LOG_INFO("cmd_cache: %lu", storage->get_cmd_cache_size());
     LOG_INFO("blk_cache: %lu", storage->get_blk_cache_size());
+    LOG_INFO("blk_pruned: %lu", get_npruned());
+    LOG_INFO("prune_pending: %lu", get_prune_pending());
+    LOG_INFO("stable_ckpt: %u", get_stable_ckpt().first.height);
+    if (!learners.empty())
+        LOG_INFO("learners: %lu subscribed", learner_height.size());
+    if (sync_segment_size)
+        LOG_INFO("swarm sync: %s, %lu blocks synced",
+                syncing ? "running" : "idle", nsynced);
+    if (faults)
+        LOG_INFO("faults: %lu dropped, %lu delayed, %lu duplicated",
+                faults->get_ndropped(), faults->get_ndelayed(),
+                faults->get_nduplicated());
+    if (compressor)
+        LOG_INFO("compressed: %lu (%lu bytes saved)", ncompressed, compress_saved);
     LOG_INFO("------ misc (10s) -----");
     LOG_INFO("fetched: %lu", part_fetched);
     LOG_INFO("delivered: %lu", part_delivered);
@@ -305,6 +1274,8 @@ void HotStuffBase::print_stat() const {
             std::string(replica).c_str(), ns, nsb, nr, nrb, part_fetched_replica[replica]);
         _nsent += ns;
         _nrecv += nr;
+        nsentb += nsb;
+        nrecvb += nrb;
         part_fetched_replica[replica] = 0;
     }
     nsent += _nsent;
@@ -314,6 +1285,8 @@ void HotStuffBase::print_stat() const {
     LOG_INFO("--- replica msg. total ---");
     LOG_INFO("sent: %lu", nsent);
     LOG_INFO("recv: %lu", nrecv);
+    LOG_INFO("sent bytes: %lu", nsentb);
+    LOG_INFO("recv bytes: %lu", nrecvb);
 #endif
     LOG_INFO("====== end stats ======");
 }
@@ -334,9 +1307,43 @@ HotStuffBase::HotStuffBase(uint32_t blk_size,
         vpool(ec, nworker),
         pn(ec, netconfig),
         pmaker(std::move(pmaker)),
+        max_delivery_fetch(256),
+        delivery_pumping(false),
+        deciding(false),
+        prune_budget(0),
+        prune_scheduled(false),
+        snapshot_period(0),
+        vote_fd(-1),
+        batch_delay(0),
+        batch_max_bytes(0),
+        batch_scheduled(false),
+        compress_threshold(0),
+        compress_budget(0),
+        compress_credit(0),
+        compress_last(std::chrono::steady_clock::now()),
+        read_nonce(0),
+        read_vheight(0),
+        read_index_enabled(false),
+        read_timeout(5),
+        read_timer_scheduled(false),
+        learner_scheduled(false),
+        learn_period(1),
+        sync_segment_size(0),
+        sync_timeout(5),
+        syncing(false),
+        sync_round(0),
+        sync_from(0),
+        sync_to(0),
+        sync_next_req(0),
+        sync_low(0),
+        sync_rr(0),
+        header_first(false),
 
         fetched(0), delivered(0),
         nsent(0), nrecv(0),
+        nsentb(0), nrecvb(0),
+        ncompressed(0), compress_saved(0),
+        nsynced(0),
         part_parent_size(0),
         part_fetched(0),
         part_delivered(0),
@@ -346,52 +1353,358 @@ HotStuffBase::HotStuffBase(uint32_t blk_size,
         part_delivery_time_min(double_inf),
         part_delivery_time_max(0)
 {
+    /* a body may complete a block by any message carrying it */
+    storage->set_body_cb([this](const block_t &blk) { on_fetch_body(blk); });
     /* register the handlers for msg from replicas */
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::propose_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::propose_header_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::blk_body_handler, this, _1, _2));
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::vote_handler, this, _1, _2));
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_blk_handler, this, _1, _2));
     pn.reg_handler(salticidae::generic_bind(&HotStuffBase::resp_blk_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::ckpt_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::batch_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::compressed_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::compress_caps_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::read_index_req_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::read_index_resp_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::learn_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::committed_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::req_segment_handler, this, _1, _2));
+    pn.reg_handler(salticidae::generic_bind(&HotStuffBase::resp_segment_handler, this, _1, _2));
     pn.reg_conn_handler(salticidae::generic_bind(&HotStuffBase::conn_handler, this, _1, _2));
+    prune_timer = TimerEvent(ec, [this](TimerEvent &) {
+        prune_scheduled = false;
+        /* yield to the event loop if the budget runs out */
+        if (prune_step(prune_budget))
+            do_prune();
+    });
+    delivery_timer = WheelTimer(ec, [this](WheelTimer &) {
+        /* a fetch that does not resolve in time (e.g., of a made-up parent)
+         * keeps going without holding up the others */
+        const auto now = std::chrono::steady_clock::now();
+        const std::chrono::duration<double> timeout(delivery_slot_timeout);
+        for (auto it = delivery_fetching.begin(); it != delivery_fetching.end();)
+        {
+            if (now - it->second < timeout)
+            {
+                it++;
+                continue;
+            }
+            delivery_fetch_slow.insert(it->first);
+            it = delivery_fetching.erase(it);
+        }
+        drain_stale_delivery();
+        if (!blk_delivery_waiting.empty())
+            delivery_timer.add(delivery_slot_timeout / 2);
+    });
+    batch_timer = TimerEvent(ec, [this](TimerEvent &) {
+        batch_scheduled = false;
+        for (auto &p: batch_buffers)
+            flush_batch(p.first, p.second);
+    });
+    snapshot_timer = TimerEvent(ec, [this](TimerEvent &) {
+        save_snapshot();
+        snapshot_timer.add(snapshot_period);
+    });
+    read_timer = TimerEvent(ec, [this](TimerEvent &) {
+        read_timer_scheduled = false;
+        expire_reads();
+        if (!read_queued.empty() || !read_confirming.empty() ||
+            !read_waiting.empty())
+        {
+            read_timer_scheduled = true;
+            read_timer.add(read_timeout / 4);
+        }
+    });
+    read_exec_timer = TimerEvent(ec, [this](TimerEvent &) { apply_reads(); });
+    learner_timer = TimerEvent(ec, [this](TimerEvent &) {
+        learner_scheduled = false;
+        for (auto &p: learner_height)
+            feed_learner(p.first, p.second);
+    });
+    learn_timer = TimerEvent(ec, [this](TimerEvent &) {
+        /* catch up in segments first (subscribing if not far behind) */
+        if (sync_segment_size)
+            start_sync();
+        else
+        {
+            /* also resumes the stream after reconnecting */
+            for (const auto &addr: learn_source_addrs)
+                send_msg(MsgLearn(get_b_exec()->get_height()), addr);
+        }
+        learn_timer.add(learn_period);
+    });
+    sync_timer = WheelTimer(ec, [this](WheelTimer &) {
+        if (!syncing) return;
+        /* ask another replica for what does not arrive in time */
+        const auto now = std::chrono::steady_clock::now();
+        const std::chrono::duration<double> timeout(sync_timeout);
+        for (auto &p: sync_segments)
+        {
+            auto &seg = p.second;
+            if (!seg.blks.empty() || now - seg.sent < timeout) continue;
+            if (!request_segment(p.first, seg))
+            {
+                finish_sync();
+                return;
+            }
+        }
+        sync_timer.add(sync_timeout / 2);
+    });
     pn.start();
     pn.listen(listen_addr);
 }
 
 void HotStuffBase::do_broadcast_proposal(const Proposal &prop) {
     //MsgPropose prop_msg(prop);
-    pn.multicast_msg(MsgPropose(prop), peers);
+    if (header_first)
+    {
+        multicast_msg(MsgProposeHeader(prop));
+        multicast_msg(MsgBlockBody(*prop.blk));
+    }
+    else
+        multicast_msg(MsgPropose(prop));
     //for (const auto &replica: peers)
     //    pn.send_msg(prop_msg, replica);
 }
 
 void HotStuffBase::do_vote(ReplicaID last_proposer, const Vote &vote) {
-    pmaker->beat_resp(last_proposer)
-            .then([this, vote](ReplicaID proposer) {
-        if (proposer == get_id())
-        {
-            throw HotStuffError("unreachable line");
-            //on_receive_vote(vote);
-        }
-        else
-            pn.send_msg(MsgVote(vote), get_config().get_addr(proposer));
+    /* only vote with the body at hand, so that a certified block can always
+     * be fetched from some correct replica */
+    async_fetch_body(storage->find_blk(vote.blk_hash))
+            .then([this, last_proposer, vote]() {
+        pmaker->beat_resp(last_proposer)
+                .then([this, vote](ReplicaID proposer) {
+            if (proposer == get_id())
+            {
+                throw HotStuffError("unreachable line");
+                //on_receive_vote(vote);
+            }
+            else
+                send_msg(MsgVote(vote), get_config().get_addr(proposer));
+        });
     });
 }
 
 void HotStuffBase::do_consensus(const block_t &blk) {
     pmaker->on_consensus(blk);
+    /* the bodies of the blocks not extending the committed one are useless */
+    for (auto it = body_fetch_waiting.begin(); it != body_fetch_waiting.end();)
+    {
+        block_t b = storage->find_blk(it->first);
+        if (!b || b->get_height() <= blk->get_height())
+            it = body_fetch_waiting.erase(it);
+        else
+            it++;
+    }
+    /* the block is only executed after this call, so check the reads on
+     * the next iteration of the event loop */
+    if (!read_waiting.empty() && read_waiting.begin()->first <= blk->get_height())
+        read_exec_timer.add(0);
+    /* push to the learners once the commit proof is settled */
+    if (!learner_height.empty() && !learner_scheduled)
+    {
+        learner_scheduled = true;
+        learner_timer.add(0);
+    }
+    if (commit_feed)
+        commit_feed->append(CommitRecord(blk->get_height(), blk->get_hash(), blk->get_cmds()));
+    if (blk_log)
+    {
+        DataStream s;
+        s << *blk;
+        bytearray_t raw = std::move(s);
+        blk_log->append(blk->get_height(), std::move(raw));
+    }
+}
+
+void HotStuffBase::do_prune() {
+    if (prune_scheduled) return;
+    prune_scheduled = true;
+    prune_timer.add(0);
+}
+
+void HotStuffBase::do_broadcast_checkpoint(const CheckpointVote &vote) {
+    multicast_msg(MsgCheckpoint(vote));
+}
+
+void HotStuffBase::do_checkpoint(const Checkpoint &ckpt, const QuorumCert &qc) {
+    LOG_INFO("stable checkpoint at height %u", ckpt.height);
+    state_machine_checkpoint(ckpt, qc);
+}
+
+class PartCertSignTask: public SignTask {
+    HotStuffCore *hsc;
+    const PrivKey &priv_key;
+    uint256_t blk_hash;
+    public:
+    part_cert_bt cert;
+    PartCertSignTask(HotStuffCore *hsc, const PrivKey &priv_key,
+                    const uint256_t &blk_hash):
+        hsc(hsc), priv_key(priv_key), blk_hash(blk_hash) {}
+    void sign() override { cert = hsc->create_part_cert(priv_key, blk_hash); }
+};
+
+promise_t HotStuffBase::async_create_part_cert(const PrivKey &priv_key, const uint256_t &blk_hash) {
+    if (!spool)
+        return HotStuffCore::async_create_part_cert(priv_key, blk_hash);
+    auto task = new PartCertSignTask(this, priv_key, blk_hash);
+    /* the task is still alive when the promise is resolved */
+    return spool->sign(task).then([task]() {
+        return task->cert.unwrap();
+    });
+}
+
+void HotStuffBase::do_decide(const BlockFinality &bfin) {
+    part_decided += bfin.size();
+    if (committed_filter)
+        for (const auto &cmd_hash: bfin.cmds)
+            committed_filter->insert(cmd_hash, bfin.height);
+    state_machine_execute_blk(bfin);
+    if (get_ckpt_period() || read_index_enabled)
+    {
+        /* a single hash per block */
+        DataStream s;
+        s << exec_digest;
+        for (const auto &cmd_hash: bfin.cmds) s << cmd_hash;
+        exec_digest = s.get_hash();
+    }
+    deciding = true;
+    /* skip the lookups if no command is waiting (e.g., for a learner) */
+    if (!decision_waiting.empty())
+    {
+        for (size_t i = 0; i < bfin.size(); i++)
+        {
+            auto it = decision_waiting.find(bfin.cmds[i]);
+            if (it == decision_waiting.end()) continue;
+            auto &req = it->second;
+            Finality fin = bfin.get(i);
+            if (req.session)
+            {
+                auto &sess = sessions[req.cid];
+                if (req.seq >= sess.seq)
+                {
+                    sess.seq = req.seq;
+                    sess.fin = fin;
+                }
+            }
+            req.callback(fin);
+            decision_waiting.erase(it);
+        }
+    }
+    state_machine_decided_blk(bfin);
+    deciding = false;
+}
+
+void HotStuffBase::save_snapshot() {
+    if (snapshot_path.empty()) return;
+    DataStream s;
+    if (!HotStuffCore::save_snapshot(s))
+    {
+        LOG_WARN("snapshot postponed until the block bodies arrive");
+        return;
+    }
+    /* write to a temporary file and then atomically replace the old one */
+    auto tmp_path = snapshot_path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        LOG_WARN("failed to open %s: %s", tmp_path.c_str(), strerror(errno));
+        return;
+    }
+    const uint8_t *data = s.data();
+    size_t size = s.size();
+    while (size)
+    {
+        ssize_t ret = write(fd, data, size);
+        if (ret == -1)
+        {
+            if (errno == EINTR) continue;
+            LOG_WARN("failed to write %s: %s", tmp_path.c_str(), strerror(errno));
+            close(fd);
+            unlink(tmp_path.c_str());
+            return;
+        }
+        data += ret;
+        size -= ret;
+    }
+    fsync(fd);
+    close(fd);
+    if (rename(tmp_path.c_str(), snapshot_path.c_str()) == -1)
+        LOG_WARN("failed to rename %s: %s", tmp_path.c_str(), strerror(errno));
+    else
+        LOG_INFO("snapshot (%lu bytes) written to %s",
+                s.size(), snapshot_path.c_str());
+}
+
+void HotStuffBase::load_snapshot() {
+    int fd = open(snapshot_path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        if (errno != ENOENT)
+            LOG_WARN("failed to open %s: %s", snapshot_path.c_str(), strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+    void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        LOG_WARN("failed to map %s: %s", snapshot_path.c_str(), strerror(errno));
+        return;
+    }
+    DataStream s((const uint8_t *)base, (const uint8_t *)base + st.st_size);
+    munmap(base, st.st_size);
+    try {
+        HotStuffCore::load_snapshot(s);
+    } catch (std::exception &e) {
+        LOG_WARN("ignored the snapshot %s: %s", snapshot_path.c_str(), e.what());
+    }
 }
 
-void HotStuffBase::do_decide(Finality &&fin) {
-    part_decided++;
-    state_machine_execute(fin);
-    auto it = decision_waiting.find(fin.cmd_hash);
-    if (it != decision_waiting.end())
+/* vheight, the height of the lock and its hash */
+static const size_t vote_state_size = 4 + 4 + 32;
+
+void HotStuffBase::load_vote_state() {
+    auto path = snapshot_path + ".vote";
+    vote_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (vote_fd == -1)
+        throw HotStuffError("failed to open %s: %s", path.c_str(), strerror(errno));
+    uint8_t buff[vote_state_size];
+    ssize_t ret = pread(vote_fd, buff, vote_state_size, 0);
+    if (ret == 0) return; /* no vote yet */
+    if (ret != (ssize_t)vote_state_size)
+        throw HotStuffError("malformed vote state in %s", path.c_str());
+    DataStream s(buff, buff + vote_state_size);
+    uint32_t vheight, lock_height;
+    uint256_t lock_hash;
+    s >> vheight >> lock_height >> lock_hash;
+    restore_vote_state(vheight, lock_hash, lock_height);
+}
+
+bool HotStuffBase::do_persist_vote(uint32_t vheight, const block_t &lock) {
+    if (vote_fd == -1) return true;
+    DataStream s;
+    s << vheight << lock->get_height() << lock->get_hash();
+    /* a single record within a sector, overwritten in place */
+    if (pwrite(vote_fd, s.data(), s.size(), 0) != (ssize_t)s.size() ||
+        fdatasync(vote_fd) == -1)
     {
-        it->second(std::move(fin));
-        decision_waiting.erase(it);
+        LOG_WARN("failed to record the vote state: %s", strerror(errno));
+        return false;
     }
+    return true;
 }
 
-HotStuffBase::~HotStuffBase() {}
+HotStuffBase::~HotStuffBase() {
+    if (vote_fd != -1) close(vote_fd);
+}
 
 void HotStuffBase::start(
         std::vector<std::tuple<NetAddr, pubkey_bt, uint256_t>> &&replicas,
@@ -401,43 +1714,114 @@ void HotStuffBase::start(
         auto &addr = std::get<0>(replicas[i]);
         HotStuffCore::add_replica(i, addr, std::move(std::get<1>(replicas[i])));
         valid_tls_certs.insert(std::move(std::get<2>(replicas[i])));
+        peer_rid[addr] = i;
         if (addr != listen_addr)
         {
             peers.push_back(addr);
             pn.add_peer(addr);
         }
     }
+    for (const auto &l: learners)
+    {
+        valid_tls_certs.insert(l.second);
+        pn.add_peer(l.first);
+    }
 
-    /* ((n - 1) + 1 - 1) / 3 */
-    uint32_t nfaulty = peers.size() / 3;
+    uint32_t nfaulty = (replicas.size() - 1) / 3;
     if (nfaulty == 0)
         LOG_WARN("too few replicas in the system to tolerate any failure");
     on_init(nfaulty);
+    if (is_learner())
+    {
+        /* a learner never signs anything */
+        set_ckpt_period(0);
+        for (auto rid: learn_sources)
+        {
+            if (rid >= replicas.size())
+                throw HotStuffError("learner source %u out of range", rid);
+            learn_source_addrs.push_back(get_config().get_addr(rid));
+        }
+        learn_timer.add(0);
+    }
+    if (!snapshot_path.empty())
+    {
+        load_snapshot();
+        if (!is_learner()) load_vote_state();
+        if (snapshot_period > 0)
+            snapshot_timer.add(snapshot_period);
+    }
     pmaker->init(this);
+    if (faults) faults->start();
     if (ec_loop)
         ec.dispatch();
 
     cmd_pending.reg_handler(ec, [this](cmd_queue_t &q) {
-        std::pair<uint256_t, commit_cb_t> e;
+        CmdRequest e;
         while (q.try_dequeue(e))
         {
             ReplicaID proposer = pmaker->get_proposer();
 
-            const auto &cmd_hash = e.first;
+            const uint256_t cmd_hash = e.cmd_hash;
+            if (e.session)
+            {
+                auto sit = sessions.find(e.cid);
+                if (sit != sessions.end() && e.seq <= sit->second.seq)
+                {
+                    /* already executed */
+                    if (e.seq == sit->second.seq)
+                        e.callback(sit->second.fin);
+                    else
+                        e.callback(Finality(id, 0, 0, 0, cmd_hash, uint256_t()));
+                    continue;
+                }
+            }
+            if (committed_filter && committed_filter->contains(cmd_hash))
+            {
+                /* a replay of a recently committed command */
+                e.callback(Finality(id, 0, 0, 0, cmd_hash, uint256_t()));
+                continue;
+            }
             auto it = decision_waiting.find(cmd_hash);
             if (it == decision_waiting.end())
-                it = decision_waiting.insert(std::make_pair(cmd_hash, e.second)).first;
+                decision_waiting.insert(std::make_pair(cmd_hash, std::move(e)));
+            else if (e.session)
+            {
+                /* a retry waits for the same decision instead of being
+                 * proposed again */
+                auto &req = it->second;
+                req.callback = [cb1 = std::move(req.callback),
+                                cb2 = std::move(e.callback)](const Finality &fin) {
+                    cb1(fin);
+                    cb2(fin);
+                };
+                continue;
+            }
             else
-                e.second(Finality(id, 0, 0, 0, cmd_hash, uint256_t()));
+                e.callback(Finality(id, 0, 0, 0, cmd_hash, uint256_t()));
             if (proposer != get_id()) continue;
             cmd_pending_buffer.push(cmd_hash);
             if (cmd_pending_buffer.size() >= blk_size)
             {
                 std::vector<uint256_t> cmds;
-                for (uint32_t i = 0; i < blk_size; i++)
+                while (cmds.size() < blk_size && !cmd_pending_buffer.empty())
                 {
-                    cmds.push_back(cmd_pending_buffer.front());
+                    auto cmd = cmd_pending_buffer.front();
                     cmd_pending_buffer.pop();
+                    /* skip the commands committed since they were buffered
+                     * (e.g., a duplicate, or proposed by another replica);
+                     * one still waiting for its decision is not committed,
+                     * whatever the filter says */
+                    if (committed_filter &&
+                        !decision_waiting.count(cmd) &&
+                        committed_filter->contains(cmd))
+                        continue;
+                    cmds.push_back(cmd);
+                }
+                if (cmds.size() < blk_size)
+                {
+                    /* wait for more commands */
+                    for (auto &cmd: cmds) cmd_pending_buffer.push(cmd);
+                    continue;
                 }
                 pmaker->beat().then([this, cmds = std::move(cmds)](ReplicaID proposer) {
                     if (proposer == get_id())
@@ -0,0 +1,116 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hotstuff/util.h"
+#include "hotstuff/merkle.h"
+
+namespace hotstuff {
+
+static uint256_t merkle_leaf(const uint256_t &leaf) {
+    DataStream s;
+    s << (uint8_t)0 << leaf;
+    return s.get_hash();
+}
+
+static uint256_t merkle_node(const uint256_t &left, const uint256_t &right) {
+    DataStream s;
+    s << (uint8_t)1 << left << right;
+    return s.get_hash();
+}
+
+/* reduce a level of the tree to the next one */
+static std::vector<uint256_t> merkle_reduce(const std::vector<uint256_t> &level) {
+    size_t n = level.size();
+    std::vector<uint256_t> next;
+    next.reserve((n + 1) >> 1);
+    for (size_t i = 0; i < n; i += 2)
+        next.push_back(i + 1 < n ? merkle_node(level[i], level[i + 1]) : level[i]);
+    return next;
+}
+
+uint256_t merkle_root(const std::vector<uint256_t> &leaves) {
+    if (leaves.empty()) return uint256_t();
+    std::vector<uint256_t> level;
+    level.reserve(leaves.size());
+    for (const auto &leaf: leaves)
+        level.push_back(merkle_leaf(leaf));
+    while (level.size() > 1)
+        level = merkle_reduce(level);
+    return level[0];
+}
+
+MerkleTree::MerkleTree(const std::vector<uint256_t> &leaves) {
+    if (leaves.empty()) return;
+    std::vector<uint256_t> level;
+    level.reserve(leaves.size());
+    for (const auto &leaf: leaves)
+        level.push_back(merkle_leaf(leaf));
+    levels.push_back(std::move(level));
+    while (levels.back().size() > 1)
+        levels.push_back(merkle_reduce(levels.back()));
+}
+
+uint256_t MerkleTree::get_root() const {
+    return levels.empty() ? uint256_t() : levels.back()[0];
+}
+
+MerkleProof MerkleTree::prove(uint32_t index) const {
+    if (levels.empty() || index >= levels[0].size())
+        throw HotStuffError("leaf %u out of range", index);
+    MerkleProof proof;
+    proof.index = index;
+    proof.nleaves = levels[0].size();
+    size_t idx = index;
+    for (size_t i = 0; i + 1 < levels.size(); i++, idx >>= 1)
+    {
+        size_t sib = idx ^ 1;
+        if (sib < levels[i].size())
+            proof.siblings.push_back(levels[i][sib]);
+    }
+    return proof;
+}
+
+void MerkleProof::serialize(DataStream &s) const {
+    s << htole(index) << htole(nleaves) << (uint8_t)siblings.size();
+    for (const auto &h: siblings) s << h;
+}
+
+void MerkleProof::unserialize(DataStream &s) {
+    uint8_t n;
+    s >> index >> nleaves >> n;
+    index = letoh(index);
+    nleaves = letoh(nleaves);
+    siblings.resize(n);
+    for (auto &h: siblings) s >> h;
+}
+
+bool MerkleProof::verify(const uint256_t &leaf, const uint256_t &root) const {
+    if (index >= nleaves) return false;
+    uint256_t h = merkle_leaf(leaf);
+    size_t k = 0;
+    for (size_t idx = index, n = nleaves; n > 1; idx >>= 1, n = (n + 1) >> 1)
+    {
+        size_t sib = idx ^ 1;
+        if (sib >= n) continue; /* carried up */
+        if (k == siblings.size()) return false;
+        h = idx & 1 ? merkle_node(siblings[k], h) : merkle_node(h, siblings[k]);
+        k++;
+    }
+    return k == siblings.size() && h == root;
+}
+
+}
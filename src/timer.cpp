@@ -0,0 +1,214 @@
+/**
+ * Copyright 2018 VMware
+ * Copyright 2018 Ted Yin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <unordered_map>
+
+#include "hotstuff/timer.h"
+
+namespace hotstuff {
+
+const int TimerWheel::level_bits;
+const uint64_t TimerWheel::level_size;
+const uint64_t TimerWheel::level_mask;
+const int TimerWheel::nlevels;
+
+TimerWheel::TimerWheel(const EventContext &ec, double resolution):
+        ec(ec), resolution(resolution),
+        start(std::chrono::steady_clock::now()),
+        base(0), count(0), armed(false), armed_tick(0) {
+    tick_timer = TimerEvent(this->ec, [this](TimerEvent &) {
+        armed = false;
+        on_tick();
+    });
+}
+
+std::shared_ptr<TimerWheel> TimerWheel::get(const EventContext &ec) {
+    /* keyed by the underlying loop, as the contexts are handles; a wheel
+     * is kept until the thread exits (and its last timer goes), so it is
+     * never freed by a callback */
+    static thread_local std::unordered_map<const void *, std::shared_ptr<TimerWheel>> wheels;
+    auto &wheel = wheels[(const void *)ec.get()];
+    if (!wheel) wheel = std::make_shared<TimerWheel>(ec);
+    return wheel;
+}
+
+void TimerWheel::place(Node *node) {
+    uint64_t idx = node->expire - base;
+    Node *slot;
+    if (idx < level_size)
+        slot = &slots[0][node->expire & level_mask];
+    else
+    {
+        int level = 1;
+        while (level < nlevels - 1 &&
+                idx >= ((uint64_t)1 << (level_bits * (level + 1))))
+            level++;
+        /* beyond the range of the wheel: wait in the last level, which
+         * sends it down again later */
+        const uint64_t max_idx = ((uint64_t)1 << (level_bits * nlevels)) - 1;
+        if (idx > max_idx) node->expire = base + max_idx;
+        slot = &slots[level][(node->expire >> (level_bits * level)) & level_mask];
+    }
+    node->prev = slot->prev;
+    node->next = slot;
+    slot->prev->next = node;
+    slot->prev = node;
+}
+
+void TimerWheel::schedule(Node *node, double t) {
+    if (node->linked()) cancel(node);
+    double now = now_time();
+    /* idle until now: skip the empty ticks */
+    if (count == 0) base = std::max(base, (uint64_t)now);
+    /* counted from the current time, which the wheel may lag behind, and
+     * rounded up so it never expires early */
+    node->expire = std::max((uint64_t)std::ceil(now + std::max(t, 0.0) / resolution),
+                            std::max((uint64_t)now + 1, base));
+    place(node);
+    count++;
+    if (!armed || node->expire < armed_tick)
+        rearm();
+}
+
+void TimerWheel::cancel(Node *node) {
+    node->unlink();
+    count--;
+}
+
+bool TimerWheel::cascade(int level) {
+    uint64_t idx = (base >> (level_bits * level)) & level_mask;
+    Node *slot = &slots[level][idx];
+    /* take the whole list before placing the nodes to the lower levels */
+    Node list;
+    if (slot->linked())
+    {
+        list.next = slot->next;
+        list.prev = slot->prev;
+        list.next->prev = list.prev->next = &list;
+        slot->prev = slot->next = slot;
+    }
+    while (list.linked())
+    {
+        Node *node = list.next;
+        node->unlink();
+        place(node);
+    }
+    return idx != 0;
+}
+
+void TimerWheel::on_tick() {
+    uint64_t target = now_tick();
+    while (count && base <= target)
+    {
+        uint64_t idx = base & level_mask;
+        if (idx == 0)
+            for (int level = 1; level < nlevels && !cascade(level); level++);
+        base++;
+        /* run the expired timers as a batch, each could add or delete any
+         * timer (including itself) */
+        Node *slot = &slots[0][idx];
+        Node list;
+        if (slot->linked())
+        {
+            list.next = slot->next;
+            list.prev = slot->prev;
+            list.next->prev = list.prev->next = &list;
+            slot->prev = slot->next = slot;
+        }
+        while (list.linked())
+        {
+            Node *node = list.next;
+            cancel(node);
+            node->firing = true;
+            node->callback(*node->owner);
+            node->firing = false;
+            if (node->dead) delete node;
+        }
+    }
+    if (count == 0)
+        base = std::max(base, target + 1);
+    else
+        rearm();
+}
+
+void TimerWheel::rearm() {
+    if (count == 0) return;
+    /* the next non-empty slot within the level, or the next cascade */
+    uint64_t next = base;
+    for (uint64_t i = 0; i < level_size; i++, next++)
+    {
+        if ((next & level_mask) == 0 ||
+            slots[0][next & level_mask].linked())
+            break;
+    }
+    if (armed && armed_tick <= next) return;
+    armed = true;
+    armed_tick = next;
+    double delay = ((double)next - (double)now_tick()) * resolution;
+    tick_timer.del();
+    tick_timer.add(std::max(delay, 0.0));
+}
+
+WheelTimer::WheelTimer(const EventContext &ec, callback_t callback):
+        wheel(TimerWheel::get(ec)), node(new TimerWheel::Node()) {
+    node->owner = this;
+    node->callback = std::move(callback);
+}
+
+WheelTimer::WheelTimer(WheelTimer &&other):
+        wheel(std::move(other.wheel)), node(other.node) {
+    other.node = nullptr;
+    if (node) node->owner = this;
+}
+
+WheelTimer &WheelTimer::operator=(WheelTimer &&other) {
+    if (this != &other)
+    {
+        clear();
+        wheel = std::move(other.wheel);
+        node = other.node;
+        other.node = nullptr;
+        if (node) node->owner = this;
+    }
+    return *this;
+}
+
+void WheelTimer::add(double t) {
+    if (node) wheel->schedule(node, t);
+}
+
+void WheelTimer::del() {
+    if (node && node->linked()) wheel->cancel(node);
+}
+
+void WheelTimer::clear() {
+    if (!node) return;
+    del();
+    if (node->firing)
+    {
+        /* freed by the wheel once the callback returns */
+        node->dead = true;
+        node->owner = nullptr;
+    }
+    else
+        delete node;
+    node = nullptr;
+    wheel = nullptr;
+}
+
+}
@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hotstuff/blocklog.h"
+
+using namespace hotstuff;
+
+static bytearray_t gen_payload(uint32_t height) {
+    return bytearray_t(height % 97 + 1, (uint8_t)height);
+}
+
+static uint32_t check_log(const BlockLog &log, uint32_t from, uint32_t to) {
+    auto it = log.read_from(from);
+    uint32_t height;
+    bytearray_t payload;
+    uint32_t expected = from;
+    while (it.next(height, payload))
+    {
+        assert(height == expected);
+        assert(payload == gen_payload(height));
+        expected++;
+    }
+    assert(expected == to + 1);
+    return expected - from;
+}
+
+int main() {
+    char tmpl[] = "/tmp/hotstuff-blocklog-XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    BlockLog::Config config;
+    config.segment_size = 4096;
+    config.index_interval = 8;
+    {
+        BlockLog log(dir, config);
+        for (uint32_t h = 1; h <= 1000; h++)
+        {
+            log.append(h, gen_payload(h));
+            if (h % 10 == 0) log.flush();
+        }
+        /* unflushed records are invisible */
+        printf("read %u\n", check_log(log, 1, 1000));
+        printf("segments: %u\n", log.get_nsegments());
+        assert(log.get_nsegments() > 1);
+        printf("read %u\n", check_log(log, 517, 1000));
+    }
+    {
+        /* reopen and append with an overlapping height */
+        BlockLog log(dir, config);
+        assert(log.get_tail_height() == 1000);
+        log.append(1000, gen_payload(1));
+        log.append(1001, gen_payload(1001));
+        log.flush();
+        printf("read %u\n", check_log(log, 990, 1001));
+    }
+    {
+        /* simulate a torn write at the tail */
+        BlockLog log(dir, config);
+        auto it = log.read_from(1001);
+        uint32_t height;
+        bytearray_t payload;
+        assert(it.next(height, payload) && height == 1001);
+        char path[64];
+        snprintf(path, sizeof path, "/blk-%08u.log", log.get_nsegments() - 1);
+        int fd = open((dir + path).c_str(), O_WRONLY | O_APPEND);
+        const uint8_t garbage[] = {0xff, 0x00, 0x00, 0x00, 0x01, 0x02};
+        assert(write(fd, garbage, sizeof garbage) == sizeof garbage);
+        close(fd);
+    }
+    {
+        BlockLog log(dir, config);
+        assert(log.get_tail_height() == 1001);
+        log.append(1002, gen_payload(1002));
+        log.flush();
+        printf("read %u\n", check_log(log, 1, 1002));
+        /* a bogus length at the tail is not trusted */
+        char path[64];
+        snprintf(path, sizeof path, "/blk-%08u.log", log.get_nsegments() - 1);
+        int fd = open((dir + path).c_str(), O_WRONLY | O_APPEND);
+        const uint8_t garbage[BlockLog::header_size] = {0xff, 0xff, 0xff, 0xff, 0x03, 0x04};
+        assert(write(fd, garbage, sizeof garbage) == sizeof garbage);
+        close(fd);
+        printf("read %u\n", check_log(log, 990, 1002));
+        /* a corrupted record in a sealed segment is reported */
+        fd = open((dir + "/blk-00000000.log").c_str(), O_WRONLY);
+        const uint8_t flip = 0x5a;
+        assert(pwrite(fd, &flip, 1, BlockLog::header_size) == 1);
+        close(fd);
+        auto it = log.read_from(1);
+        uint32_t height;
+        bytearray_t payload;
+        bool caught = false;
+        try {
+            while (it.next(height, payload));
+        } catch (HotStuffError &) {
+            caught = true;
+        }
+        assert(caught);
+    }
+    printf("ok\n");
+    return 0;
+}
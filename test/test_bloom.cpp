@@ -0,0 +1,46 @@
+#include <cstdio>
+#include <cassert>
+#include <stdexcept>
+
+#include "hotstuff/bloom.h"
+
+using hotstuff::uint256_t;
+using hotstuff::DataStream;
+using hotstuff::RotatingBloomFilter;
+
+static uint256_t gen_hash(uint32_t i) {
+    DataStream s;
+    s << i;
+    return s.get_hash();
+}
+
+int main() {
+    const uint32_t window = 10;
+    const uint32_t per_height = 100;
+    RotatingBloomFilter filter(window * per_height, 1e-3, window);
+    for (uint32_t h = 1; h <= 50; h++)
+    {
+        for (uint32_t j = 0; j < per_height; j++)
+            filter.insert(gen_hash(h * per_height + j), h);
+        /* no false negatives within the window */
+        for (uint32_t k = h >= window ? h - window + 1 : 1; k <= h; k++)
+            for (uint32_t j = 0; j < per_height; j++)
+                assert(filter.contains(gen_hash(k * per_height + j)));
+    }
+    /* the old heights are forgotten */
+    size_t old = 0;
+    for (uint32_t h = 1; h <= 20; h++)
+        for (uint32_t j = 0; j < per_height; j++)
+            old += filter.contains(gen_hash(h * per_height + j));
+    assert(old < 10);
+    /* false positives */
+    size_t fp = 0, n = 100000;
+    for (uint32_t i = 0; i < n; i++)
+        fp += filter.contains(gen_hash(1000000 + i));
+    printf("false positive rate: %.5f\n", fp / (double)n);
+    assert(fp < n / 100);
+    filter.clear();
+    assert(!filter.contains(gen_hash(50 * per_height)));
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include <cassert>
+
+#include "hotstuff/crypto.h"
+
+using namespace hotstuff;
+
+int main() {
+    PrivKeyEd25519 p;
+    p.from_hex("9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60");
+    pubkey_bt pub = p.get_pubkey();
+    /* RFC 8032, test 1 */
+    printf("%s\n", get_hex(*pub).c_str());
+    assert(get_hex(*pub) ==
+        "d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a");
+    SigEd25519 kat;
+    kat.sign(bytearray_t(), p);
+    assert(get_hex(kat) ==
+        "e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e065224901555fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b");
+    assert(kat.verify(bytearray_t(), static_cast<const PubKeyEd25519 &>(*pub)));
+    DataStream s;
+    s << *pub;
+    PubKeyEd25519 pub2;
+    s >> pub2;
+    printf("%s\n", get_hex(pub2).c_str());
+    SigEd25519 sig;
+    sig.sign(bytearray_t(32), p);
+    printf("%s\n", get_hex(sig).c_str());
+    s << sig;
+    SigEd25519 sig2;
+    s >> sig2;
+    bytearray_t msg = bytearray_t(32);
+    msg[0] = 1;
+    printf("%d %d\n", sig2.verify(bytearray_t(32), pub2),
+                    sig2.verify(msg, pub2));
+    p.from_rand();
+    printf("%s\n", get_hex(p).c_str());
+    sig.sign(msg, p);
+    printf("%s\n", get_hex(sig).c_str());
+    s << sig;
+    s >> sig2;
+    printf("%d %d\n", sig2.verify(msg, PubKeyEd25519(p)),
+                    sig2.verify(msg, pub2));
+}
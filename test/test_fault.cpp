@@ -0,0 +1,49 @@
+#include <cstdio>
+#include <cassert>
+
+#include "hotstuff/fault.h"
+
+using namespace hotstuff;
+
+static FaultInjector::Rule make_rule(FaultInjector::Action action) {
+    FaultInjector::Rule rule;
+    rule.start = 0;
+    rule.end = 1e6;
+    rule.action = action;
+    rule.dest = rule.opcode = -1;
+    rule.prob = 1;
+    rule.param = 0;
+    return rule;
+}
+
+int main() {
+    EventContext ec;
+    FaultInjector fi(ec, 0, 42);
+    /* a partition followed by an overlapping duplicate rule */
+    auto part = make_rule(FaultInjector::PARTITION);
+    part.group = {0, 1};
+    fi.add_rule(part);
+    fi.add_rule(make_rule(FaultInjector::DUPLICATE));
+    fi.start();
+    for (int i = 0; i < 100; i++)
+    {
+        /* crossing the boundary: cut off, never duplicated */
+        auto v = fi.judge(2, 0x0);
+        assert(v.ncopies == 0);
+        /* within the group: duplicated */
+        v = fi.judge(1, 0x0);
+        assert(v.ncopies == 2);
+    }
+    assert(fi.get_ndropped() == 100);
+    assert(fi.get_nduplicated() == 100);
+
+    /* the same holds when the duplicate rule comes first */
+    FaultInjector fi2(ec, 3, 42);
+    fi2.add_rule(make_rule(FaultInjector::DUPLICATE));
+    fi2.add_rule(part);
+    fi2.start();
+    assert(fi2.judge(0, 0x0).ncopies == 0);
+    assert(fi2.judge(4, 0x0).ncopies == 2);
+    printf("ok\n");
+    return 0;
+}
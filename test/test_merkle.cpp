@@ -0,0 +1,52 @@
+#include <cstdio>
+#include <cassert>
+#include <stdexcept>
+
+#include "hotstuff/merkle.h"
+
+using hotstuff::uint256_t;
+using hotstuff::DataStream;
+using hotstuff::MerkleProof;
+
+static std::vector<uint256_t> gen_leaves(size_t n) {
+    std::vector<uint256_t> leaves;
+    for (size_t i = 0; i < n; i++)
+    {
+        DataStream s;
+        s << (uint32_t)i;
+        leaves.push_back(s.get_hash());
+    }
+    return leaves;
+}
+
+int main() {
+    assert(hotstuff::merkle_root({}) == uint256_t());
+    for (size_t n = 1; n <= 33; n++)
+    {
+        auto leaves = gen_leaves(n);
+        auto root = hotstuff::merkle_root(leaves);
+        hotstuff::MerkleTree tree(leaves);
+        assert(tree.get_root() == root);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            MerkleProof proof = tree.prove(i);
+            DataStream s;
+            s << proof;
+            MerkleProof proof2;
+            s >> proof2;
+            assert(proof2.verify(leaves[i], root));
+            /* wrong leaf or position */
+            assert(!proof2.verify(leaves[(i + 1) % n], root) || n == 1);
+            proof2.index = (i + 1) % n;
+            assert(!proof2.verify(leaves[i], root) || n == 1);
+        }
+        /* a list is not confused with its prefix */
+        if (n > 1)
+        {
+            leaves.pop_back();
+            assert(hotstuff::merkle_root(leaves) != root);
+        }
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <algorithm>
+#include <cassert>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <stdexcept>
+
+#include "hotstuff/timer.h"
+
+using hotstuff::EventContext;
+using hotstuff::WheelTimer;
+using hotstuff::TimerWheel;
+
+using clock_type = std::chrono::steady_clock;
+
+static double since(clock_type::time_point t) {
+    return std::chrono::duration<double>(clock_type::now() - t).count();
+}
+
+int main() {
+    EventContext ec;
+    const size_t n = 200;
+    /* spanning the first two levels of the wheel */
+    const double max_delay = 3;
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(0, max_delay);
+    std::vector<WheelTimer> timers(n);
+    std::vector<double> delay(n);
+    std::vector<int> nfired(n);
+    size_t nexpected = 0, nfinished = 0;
+    /* the default tick of the wheel */
+    const double resolution = 0.01;
+    double last_due = 0;
+    auto t0 = clock_type::now();
+    for (size_t i = 0; i < n; i++)
+    {
+        delay[i] = dist(gen);
+        timers[i] = WheelTimer(ec, [&, i](WheelTimer &t) {
+            double elapsed = since(t0);
+            /* never early, and in the order of the deadlines (up to a
+             * tick), however late the event loop runs */
+            assert(elapsed >= delay[i] - 1e-3);
+            assert(delay[i] >= last_due - resolution);
+            last_due = std::max(last_due, delay[i]);
+            if (nfired[i]++ == 0 && i % 5 == 0)
+            {
+                /* re-armed by its own callback */
+                delay[i] = elapsed + 0.2;
+                t.add(0.2);
+                return;
+            }
+            /* destroyed by its own callback */
+            if (i % 7 == 0) timers[i] = WheelTimer();
+            if (++nfinished == nexpected) ec.stop();
+        });
+        timers[i].add(delay[i]);
+    }
+    /* cancelled before expiring */
+    for (size_t i = 0; i < n; i += 3)
+        timers[i].del();
+    for (size_t i = 0; i < n; i++)
+        if (i % 3) nexpected++;
+    assert(TimerWheel::get(ec)->size() == nexpected);
+    ec.dispatch();
+    for (size_t i = 0; i < n; i++)
+        assert(nfired[i] == (i % 3 ? (i % 5 ? 1 : 2) : 0));
+    assert(TimerWheel::get(ec)->size() == 0);
+    printf("ok (%.3f sec)\n", since(t0));
+    return 0;
+}